@@ -0,0 +1,302 @@
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<string>
+#include<vector>
+#include<map>
+#include<memory>
+#include<chrono>
+#include<cstdio>
+
+#include "console.h"
+#include "nesfile.h"
+#include "hash.h"
+#include "romdb.h"
+#include "savestate.h"
+#include "screenshot.h"
+#include "movie.h"
+#include "workpool.h"
+#include "trace.h"
+#include "statehash.h"
+
+// Runs many headless emulator jobs across all cores. A job file has one job
+// per line:
+//
+//   rom.nes FRAMES [movie=run.fm2] [policy=idle|random:SEED]
+//       [ram=ADDR[-ADDR],...] [shots=FRAME,...]
+//
+// Each job gets its own Console; ROM images are shared read-only. Results go
+// out as CSV in job order: the final state hash, the requested bytes and the
+// paths of screenshots taken after the given frames.
+
+struct Job
+{
+    int line;
+    std::string rom;
+    int frames;
+    std::string movie;
+    std::string policy;
+    std::vector<std::pair<int, int>> ram;
+    std::vector<int> shots;
+};
+
+struct JobResult
+{
+    bool ok;
+    std::string error;
+    unsigned long long hash;
+    std::string ram;
+    std::string shots;
+    double seconds;
+};
+
+static bool parse_job(const std::string &line, int line_number, Job &job, std::string &error)
+{
+    std::istringstream in(line);
+    job.line = line_number;
+    job.frames = 0;
+    job.policy = "idle";
+    if(!(in >> job.rom >> job.frames) || job.frames < 0)
+    {
+        error = "expected: rom frames [key=value...]";
+        return false;
+    }
+    std::string token;
+    while(in >> token)
+    {
+        size_t equals = token.find('=');
+        std::string key = token.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : token.substr(equals + 1);
+        std::istringstream list(value);
+        std::string item;
+        if(key == "movie")
+            job.movie = value;
+        else if(key == "policy")
+            job.policy = value;
+        else if(key == "ram")
+        {
+            while(std::getline(list, item, ','))
+            {
+                size_t dash = item.find('-');
+                int first = std::stoi(item.substr(0, dash), nullptr, 0);
+                int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1), nullptr, 0);
+                job.ram.push_back(std::make_pair(first, last));
+            }
+        }
+        else if(key == "shots")
+        {
+            while(std::getline(list, item, ','))
+                job.shots.push_back(std::stoi(item));
+        }
+        else
+        {
+            error = "unknown key " + key;
+            return false;
+        }
+    }
+    if(job.policy != "idle" && job.policy.compare(0, 7, "random:") != 0)
+    {
+        error = "unknown policy " + job.policy;
+        return false;
+    }
+    return true;
+}
+
+static JobResult run_job(const Job &job, int index, std::shared_ptr<const NESFile> rom, const std::string &shots_dir, const std::string &hash_dir, int hash_every)
+{
+    JobResult result;
+    result.ok = false;
+    result.hash = 0;
+    result.seconds = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<unsigned char> movie;
+    if(!job.movie.empty() && !load_movie(job.movie, movie))
+    {
+        result.error = "can't read movie " + job.movie;
+        return result;
+    }
+    unsigned long long seed = 0;
+    if(job.policy.compare(0, 7, "random:") == 0)
+        seed = std::stoull(job.policy.substr(7)) * 0x9E3779B97F4A7C15ULL + 1; // Never zero, xorshift would stick
+    std::unique_ptr<Console> console(new Console);
+    std::vector<unsigned char> buffer(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    console->ppu.buffer = buffer.data();
+    if(!console->load_cartridge(rom))
+    {
+        result.error = rom->valid ? "unsupported mapper " + std::to_string(rom->mapper) : rom->error;
+        return result;
+    }
+    HashLog hash_log;
+    if(!hash_dir.empty())
+    {
+        std::string path = hash_dir + "/job" + std::to_string(index) + ".hashes";
+        if(!hash_log.open(path, hash_every))
+        {
+            result.error = "can't write " + path;
+            return result;
+        }
+    }
+    for(int frame = 1; frame <= job.frames; frame++)
+    {
+        unsigned char buttons = 0;
+        if(frame - 1 < (int)movie.size())
+            buttons = movie[frame - 1];
+        else if(seed)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            buttons = seed >> 56;
+        }
+        console->cpu.controller_buttons = buttons;
+        bool shot = false;
+        for(int f : job.shots)
+            shot = shot || f == frame;
+        console->run_frame(shot);
+        hash_log.frame_done(*console);
+        if(shot)
+        {
+            std::string path = shots_dir + "/job" + std::to_string(index) + "_frame" + std::to_string(frame) + ".ppm";
+            if(!write_ppm(path, buffer.data()))
+            {
+                result.error = "can't write " + path;
+                return result;
+            }
+            result.shots += (result.shots.empty() ? "" : " ") + path;
+        }
+    }
+    std::unique_ptr<SaveState> state(new SaveState);
+    console->save_state(*state);
+    result.hash = hash_state(*state);
+    for(const std::pair<int, int> &range : job.ram)
+    {
+        for(int address = range.first; address <= range.second; address++)
+        {
+            unsigned char value = console->cpu.peek_memory(address); // What a debugger would see, no side effects
+            result.ram += to_hex(&value, 1);
+        }
+    }
+    result.ok = true;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *jobs_path = nullptr;
+    std::string out_path;
+    std::string shots_dir = ".";
+    std::string hash_dir; // Per-frame state hash logs, one per job
+    int hash_every = 1;
+    std::string db_path;
+    int threads = 0;
+    std::string trace_path;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--out" && i + 1 < argc)
+            out_path = argv[++i];
+        else if(arg == "--shots-dir" && i + 1 < argc)
+            shots_dir = argv[++i];
+        else if(arg == "--db" && i + 1 < argc)
+            db_path = argv[++i];
+        else if(arg == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if(arg == "--hash-dir" && i + 1 < argc)
+            hash_dir = argv[++i];
+        else if(arg == "--hash-every" && i + 1 < argc)
+            hash_every = std::stoi(argv[++i]);
+        else if(arg == "--trace" && i + 1 < argc)
+            trace_path = argv[++i];
+        else
+            jobs_path = argv[i];
+    }
+    if(!jobs_path)
+    {
+        std::cout << "Usage: " << argv[0] << " [--threads N] [--out results.csv] [--shots-dir DIR] [--db nes.db] [--hash-dir DIR] [--hash-every N] [--trace trace.json] jobs.txt" << std::endl;
+        return 1;
+    }
+    std::ifstream jobs_file(jobs_path);
+    if(!jobs_file)
+    {
+        std::cout << "CAN'T OPEN " << jobs_path << std::endl;
+        return 1;
+    }
+    RomDB db;
+    if(!db_path.empty() && !db.load(db_path))
+        std::cout << "CAN'T LOAD DB " << db_path << std::endl;
+
+    std::vector<Job> jobs;
+    std::map<std::string, std::shared_ptr<const NESFile>> roms; // Held open so every job shares one image
+    std::string line;
+    int line_number = 0;
+    while(std::getline(jobs_file, line))
+    {
+        line_number++;
+        size_t start = line.find_first_not_of(" \t");
+        if(start == std::string::npos || line[start] == '#')
+            continue;
+        Job job;
+        std::string error;
+        try
+        {
+            if(!parse_job(line, line_number, job, error))
+            {
+                std::cout << jobs_path << ":" << line_number << ": " << error << std::endl;
+                return 1;
+            }
+        }
+        catch(const std::exception &)
+        {
+            std::cout << jobs_path << ":" << line_number << ": bad number" << std::endl;
+            return 1;
+        }
+        if(!roms.count(job.rom))
+            roms[job.rom] = NESFile::shared(job.rom, &db);
+        jobs.push_back(job);
+    }
+
+    if(!trace_path.empty() && !trace_start(trace_path))
+        std::cout << "CAN'T TRACE TO " << trace_path << std::endl;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<JobResult> results(jobs.size());
+    {
+        WorkPool pool(threads);
+        threads = pool.size();
+        for(size_t i = 0; i < jobs.size(); i++)
+        {
+            pool.submit([&, i](int worker)
+            {
+                if(tracing())
+                    trace_thread_name(("worker " + std::to_string(worker)).c_str());
+                TraceSpan span("job");
+                results[i] = run_job(jobs[i], i, roms.at(jobs[i].rom), shots_dir, hash_dir, hash_every);
+            });
+        }
+        pool.wait();
+    }
+    trace_stop();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::ofstream out_file;
+    if(!out_path.empty())
+        out_file.open(out_path);
+    std::ostream &out = out_path.empty() ? std::cout : out_file;
+    out << "job,line,rom,frames,hash,ram,screenshots,seconds,error\n";
+    int failed = 0;
+    char hash[17];
+    long long frames = 0;
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        const JobResult &result = results[i];
+        std::snprintf(hash, sizeof(hash), "%016llx", result.hash);
+        out << i << ',' << jobs[i].line << ",\"" << jobs[i].rom << "\"," << jobs[i].frames << ','
+            << (result.ok ? hash : "") << ',' << result.ram << ",\"" << result.shots << "\"," << result.seconds
+            << ",\"" << result.error << "\"\n";
+        failed += !result.ok;
+        frames += result.ok ? jobs[i].frames : 0;
+    }
+    std::cerr << "RAN " << jobs.size() << " JOBS (" << failed << " FAILED) IN " << seconds << "s ON " << threads
+        << " THREADS, " << frames / std::max(seconds, 1e-9) << " FRAMES/S" << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+#include<iostream>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+
+#include "battery.h"
+
+BatteryFile::BatteryFile()
+{
+    data = nullptr;
+    size = 0;
+}
+
+BatteryFile::~BatteryFile()
+{
+    close();
+}
+
+bool BatteryFile::open(const std::string &save_path, size_t length)
+{
+    close();
+    int fd = ::open(save_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+    {
+        std::cout << "CAN'T OPEN SAVE FILE " << save_path << std::endl;
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || ((size_t)st.st_size < length && ftruncate(fd, length) != 0))
+    {
+        std::cout << "CAN'T SIZE SAVE FILE " << save_path << std::endl;
+        ::close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(map == MAP_FAILED)
+    {
+        std::cout << "CAN'T MAP SAVE FILE " << save_path << std::endl;
+        return false;
+    }
+    data = (unsigned char *)map;
+    size = length;
+    path = save_path;
+    return true;
+}
+
+void BatteryFile::flush(bool wait)
+{
+    if(data)
+        msync(data, size, wait ? MS_SYNC : MS_ASYNC);
+}
+
+void BatteryFile::close()
+{
+    if(!data)
+        return;
+    flush(true);
+    munmap(data, size);
+    data = nullptr;
+    size = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include<string>
+#include<cstddef>
+
+// Battery-backed cartridge RAM kept in a shared mapping of a .sav file.
+// Writes land in the page cache directly, so there is no save path to call
+// and no per-frame I/O; flush() just asks the kernel to write back.
+class BatteryFile
+{
+public:
+    BatteryFile();
+    ~BatteryFile();
+    BatteryFile(const BatteryFile &) = delete;
+    BatteryFile &operator=(const BatteryFile &) = delete;
+    bool open(const std::string &path, size_t size);
+    void flush(bool wait = false);
+    void close();
+    unsigned char *data;
+    size_t size;
+    std::string path;
+};
+#endif
@@ -0,0 +1,213 @@
+#include<iostream>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<memory>
+#include<chrono>
+#include<algorithm>
+#include<cstdio>
+
+#include "console.h"
+#include "nesfile.h"
+#include "statehash.h"
+#include "screenshot.h"
+#include "synthrom.h"
+
+// Whole-system benchmark. Runs each workload headless with scripted input:
+// warm-up frames first, then several timed repetitions, each restarting from
+// the state the warm-up left so they all time the same frames. Reports
+// frames/s, ns per CPU cycle and median/p95 frame times, as a table plus
+// optional CSV/JSON for diffing between commits. The CPU and PPU run in
+// lockstep, three dots per cycle, so there's no separate ns per dot to
+// measure. The final state hash shows whether a change altered emulation as
+// well as speed; it only covers architectural state, so it's the same with
+// and without --no-render.
+
+struct Workload
+{
+    std::string name;
+    std::shared_ptr<const NESFile> rom;
+};
+
+struct BenchResult
+{
+    std::string name;
+    long long frames;
+    long long cycles;
+    double seconds;
+    double median_ms;
+    double p95_ms;
+    unsigned long long hash;
+};
+
+// Taps Start now and then and otherwise walks through the d-pad and buttons,
+// enough to get most games out of their title screens
+static unsigned char scripted_input(long long frame)
+{
+    if(frame % 240 < 6)
+        return BUTTON_START;
+    static const unsigned char steps[] = {0, BUTTON_RIGHT, BUTTON_RIGHT | BUTTON_A, BUTTON_LEFT, BUTTON_B, BUTTON_UP, BUTTON_DOWN, BUTTON_A};
+    return steps[(frame / 16) % 8];
+}
+
+static double percentile(std::vector<double> samples, double fraction)
+{
+    if(samples.empty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t index = std::min(samples.size() - 1, (size_t)(fraction * (samples.size() - 1) + 0.5));
+    return samples[index];
+}
+
+static bool run_workload(const Workload &workload, int warmup, int reps, int frames, bool render, BenchResult &result)
+{
+    std::unique_ptr<Console> console(new Console);
+    std::vector<unsigned char> buffer(SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+    console->ppu.buffer = buffer.data();
+    if(!console->load_cartridge(workload.rom))
+        return false;
+    long long warm_frame = 0;
+    for(int i = 0; i < warmup; i++)
+    {
+        console->cpu.controller_buttons = scripted_input(warm_frame++);
+        console->run_frame(render);
+    }
+    std::unique_ptr<SaveState> warm(new SaveState);
+    console->save_state(*warm);
+    std::vector<double> frame_ms;
+    frame_ms.reserve((size_t)reps * frames);
+    result.name = workload.name;
+    result.frames = 0;
+    result.cycles = 0;
+    result.seconds = 0;
+    for(int rep = 0; rep < reps; rep++)
+    {
+        console->load_state(*warm);
+        long long frame = warm_frame;
+        for(int i = 0; i < frames; i++)
+        {
+            console->cpu.controller_buttons = scripted_input(frame++);
+            int start_cycle = console->cpu.cycle;
+            auto start = std::chrono::steady_clock::now();
+            console->run_frame(render);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            frame_ms.push_back(ms);
+            result.seconds += ms / 1000;
+            result.cycles += (unsigned int)(console->cpu.cycle - start_cycle);
+            result.frames++;
+        }
+    }
+    result.median_ms = percentile(frame_ms, 0.5);
+    result.p95_ms = percentile(frame_ms, 0.95);
+    StateHasher hasher;
+    result.hash = hasher.update(*console);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int warmup = 60;
+    int reps = 5;
+    int frames = 600;
+    bool render = true;
+    std::string csv_path;
+    std::string json_path;
+    std::vector<std::string> only;
+    std::vector<std::string> rom_paths;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--warmup" && i + 1 < argc)
+            warmup = std::max(0, std::stoi(argv[++i]));
+        else if(arg == "--reps" && i + 1 < argc)
+            reps = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--frames" && i + 1 < argc)
+            frames = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--no-render")
+            render = false;
+        else if(arg == "--csv" && i + 1 < argc)
+            csv_path = argv[++i];
+        else if(arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if(arg == "--only" && i + 1 < argc)
+            only.push_back(argv[++i]);
+        else if(arg == "-h" || arg == "--help")
+        {
+            std::cout << "Usage: " << argv[0] << " [--warmup N] [--reps N] [--frames N] [--no-render] [--only NAME]... [--csv out.csv] [--json out.json] [rom.nes...]" << std::endl;
+            return 0;
+        }
+        else
+            rom_paths.push_back(arg);
+    }
+
+    std::vector<Workload> workloads;
+    for(const std::string &name : synthetic_rom_names())
+        workloads.push_back({name, std::make_shared<NESFile>(synthetic_rom(name))});
+    for(const std::string &path : rom_paths)
+        workloads.push_back({path, NESFile::shared(path)});
+    if(!only.empty())
+    {
+        workloads.erase(std::remove_if(workloads.begin(), workloads.end(), [&](const Workload &workload)
+        {
+            return std::find(only.begin(), only.end(), workload.name) == only.end();
+        }), workloads.end());
+    }
+
+    std::vector<BenchResult> results;
+    std::printf("%-20s %10s %10s %10s %10s  %s\n", "workload", "frames/s", "ns/cycle", "median ms", "p95 ms", "state hash");
+    for(const Workload &workload : workloads)
+    {
+        BenchResult result;
+        if(!run_workload(workload, warmup, reps, frames, render, result))
+        {
+            std::cout << "CAN'T RUN " << workload.name << ": " << (workload.rom->valid ? "unsupported mapper" : workload.rom->error) << std::endl;
+            continue;
+        }
+        std::printf("%-20s %10.1f %10.2f %10.3f %10.3f  %016llx\n", result.name.c_str(),
+            result.frames / result.seconds, result.seconds * 1e9 / result.cycles,
+            result.median_ms, result.p95_ms, result.hash);
+        results.push_back(result);
+    }
+
+    if(!csv_path.empty())
+    {
+        std::ofstream out(csv_path);
+        out << "workload,frames,cycles,seconds,frames_per_s,ns_per_cycle,median_ms,p95_ms,state_hash\n";
+        char hash[17];
+        for(const BenchResult &result : results)
+        {
+            std::snprintf(hash, sizeof(hash), "%016llx", result.hash);
+            out << result.name << ',' << result.frames << ',' << result.cycles << ',' << result.seconds << ','
+                << result.frames / result.seconds << ',' << result.seconds * 1e9 / result.cycles << ','
+                << result.median_ms << ',' << result.p95_ms
+                << ',' << hash << '\n';
+        }
+    }
+    if(!json_path.empty())
+    {
+        std::ofstream out(json_path);
+        out << "{\"warmup\": " << warmup << ", \"reps\": " << reps << ", \"frames\": " << frames
+            << ", \"render\": " << (render ? "true" : "false") << ", \"results\": [";
+        char hash[17];
+        for(size_t i = 0; i < results.size(); i++)
+        {
+            const BenchResult &result = results[i];
+            std::string name;
+            for(char c : result.name)
+            {
+                if(c == '"' || c == '\\')
+                    name += '\\';
+                name += c;
+            }
+            std::snprintf(hash, sizeof(hash), "%016llx", result.hash);
+            out << (i ? ",\n  " : "\n  ") << "{\"workload\": \"" << name << "\", \"frames\": " << result.frames
+                << ", \"cycles\": " << result.cycles << ", \"seconds\": " << result.seconds
+                << ", \"frames_per_s\": " << result.frames / result.seconds
+                << ", \"ns_per_cycle\": " << result.seconds * 1e9 / result.cycles
+                << ", \"median_ms\": " << result.median_ms << ", \"p95_ms\": " << result.p95_ms
+                << ", \"state_hash\": \"" << hash << "\"}";
+        }
+        out << "\n]}\n";
+    }
+    return 0;
+}
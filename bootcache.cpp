@@ -0,0 +1,45 @@
+#include<sstream>
+
+#include "bootcache.h"
+
+std::string boot_key(const NESFile &rom, int frames)
+{
+    std::ostringstream key;
+    key << std::hex << rom.crc << std::dec << ':' << rom.prg_rom_size << ':' << rom.chr_rom_size
+        << ':' << rom.mapper << '.' << rom.submapper << ':' << (int)rom.mirroring << ':' << rom.four_screen
+        << ':' << rom.prg_ram_size + rom.prg_nvram_size << ':' << rom.region << ':' << frames;
+    return key.str();
+}
+
+// Puts console back to frames frames after power-on with no input. Fails if
+// it has no usable cartridge.
+bool BootCache::reset(Console &console, int frames)
+{
+    if(!console.rom || !console.mapper)
+        return false;
+    std::string key = boot_key(*console.rom, frames);
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = snapshots.find(key);
+        if(found != snapshots.end())
+            return console.load_state(*found->second, !console.battery.data); // Battery RAM survives a power cycle
+    }
+    if(!console.power_on())
+        return false;
+    unsigned char buttons = console.cpu.controller_buttons;
+    console.cpu.controller_buttons = 0;
+    for(int i = 0; i < frames; i++)
+        console.run_frame(false);
+    console.cpu.controller_buttons = buttons;
+    std::unique_ptr<SaveState> snapshot(new SaveState);
+    console.save_state(*snapshot);
+    std::lock_guard<std::mutex> guard(lock);
+    snapshots.emplace(key, std::move(snapshot)); // Another thread may have got there first, either is fine
+    return true;
+}
+
+size_t BootCache::size()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    return snapshots.size();
+}
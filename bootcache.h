@@ -0,0 +1,32 @@
+#ifndef BOOTCACHE_H
+#define BOOTCACHE_H
+
+#include<string>
+#include<memory>
+#include<mutex>
+#include<unordered_map>
+
+#include "console.h"
+#include "savestate.h"
+
+// Snapshots of consoles a number of frames after power-on. The first reset
+// of a ROM boots it for real; later ones just restore the snapshot, so
+// restarting a game thousands of times skips its boot frames entirely.
+//
+// Snapshots are keyed by the ROM's CRC32 and header fields plus the frame
+// count, so a database fix or a different boot length never reuses a stale
+// one. PRG RAM is restored from the snapshot unless it's mapped to a
+// battery file, which keeps its contents like it would on a real power
+// cycle. Safe to share between threads.
+class BootCache
+{
+public:
+    bool reset(Console &console, int frames = 0);
+    size_t size();
+private:
+    std::mutex lock;
+    std::unordered_map<std::string, std::unique_ptr<SaveState>> snapshots;
+};
+
+std::string boot_key(const NESFile &rom, int frames);
+#endif
@@ -0,0 +1,195 @@
+#include<cstring>
+
+#include "console.h"
+
+Console::Console()
+{
+    cpu.ppu = &ppu;
+    ppu.cpu = &cpu;
+}
+
+// Inserts the cartridge, puts the CPU and PPU in their power-on state and
+// jumps to the reset vector. Fails if the image is invalid or its mapper
+// isn't implemented. If the board has a battery and save_path is given, PRG
+// RAM lives in that file.
+bool Console::load_cartridge(std::shared_ptr<const NESFile> cartridge, const std::string &save_path)
+{
+    mapper.reset();
+    battery.close();
+    CPUState &cpu_state = cpu;
+    PPUState &ppu_state = ppu;
+    cpu_state = CPU();
+    ppu_state = PPU();
+    ppu.map_nametables();
+    rom = cartridge;
+    if(!rom || !rom->valid)
+        return false;
+    mapper.reset(create_mapper(&cpu, &ppu, *rom));
+    if(!mapper)
+        return false;
+    if(rom->battery && mapper->prg_ram() && !save_path.empty() && battery.open(save_path, MAPPER_PRG_RAM_SIZE))
+        mapper->set_prg_ram(battery.data);
+    cpu.hash_dirty = ~0ULL; // Every page is new to a StateHasher
+    ppu.hash_dirty = ~0ULL;
+    cpu.PC = (cpu.read_memory(0xfffd) << 8) + cpu.read_memory(0xfffc);
+    return true;
+}
+
+// Power cycles with the same cartridge and save file.
+bool Console::power_on()
+{
+    std::string save_path = battery.data ? battery.path : "";
+    return load_cartridge(rom, save_path);
+}
+
+// The reset button: RAM, cartridge RAM and mapper registers survive, the
+// CPU jumps through the reset vector with interrupts off and the PPU's
+// control registers clear.
+void Console::reset()
+{
+    cpu.S = 0x100 | ((cpu.S - 3) & 0xFF);
+    cpu.flags_int_disable = 1;
+    cpu.NMI = false;
+    cpu.IRQ = false;
+    cpu.oam_write_pending = false;
+    cpu.clocks_remain = 0;
+    cpu.PC = (cpu.read_memory(0xfffd) << 8) + cpu.read_memory(0xfffc);
+    ppu.PPUCTRL = 0;
+    ppu.PPUMASK = 0;
+    ppu.NMI_output = false;
+    ppu.NMI_occurred = false;
+    ppu.addr_scroll_latch = false;
+    ppu.fine_x = 0;
+    ppu.read_buffer = 0;
+    ppu.vram_addr_temp = 0;
+}
+
+// Runs one frame. With render false the PPU still does all timing work
+// (vblank, sprite 0 hit, scrolling) but skips pixel composition and
+// framebuffer writes.
+void Console::run_frame(bool render)
+{
+    if(tracing())
+        step_frame(tracer, render);
+    else
+        step_frame(profiler, render);
+}
+
+// Advances one real frame, then shows what the screen will look like
+// frames - 1 frames later given the current input. This hides the game's
+// own input lag frames.
+void Console::run_frame_ahead(int frames, SaveState &scratch)
+{
+    if(frames <= 0)
+    {
+        run_frame();
+        return;
+    }
+    run_frame(false);
+    preview_frames(frames, scratch);
+}
+
+// Runs frames - 1 frames without output and renders one more, then rewinds
+// to where it started, so only the framebuffer changes. Battery RAM is
+// swapped for a private copy meanwhile, so the .sav file only ever sees the
+// real timeline's writes.
+void Console::preview_frames(int frames, SaveState &scratch)
+{
+    save_state(scratch);
+    bool battery_ram = mapper && battery.data && mapper->prg_ram() == battery.data;
+    if(battery_ram)
+    {
+        ahead_prg_ram.assign(battery.data, battery.data + MAPPER_PRG_RAM_SIZE);
+        mapper->set_prg_ram(ahead_prg_ram.data());
+    }
+    for(int i = 1; i < frames; i++)
+        run_frame(false);
+    run_frame();
+    if(battery_ram)
+        mapper->set_prg_ram(battery.data);
+    load_state(scratch, !battery_ram);
+}
+
+void Console::save_state(SaveState &state) const
+{
+    init_state_header(state);
+    state.rom_crc = rom ? rom->crc : 0;
+    state.rom_mapper = rom ? rom->mapper : -1;
+    state.cpu = cpu;
+    state.ppu = ppu;
+    std::memset(state.mapper, 0, MAPPER_STATE_SIZE);
+    std::memset(state.chr_ram, 0, MAPPER_CHR_RAM_SIZE);
+    std::memset(state.prg_ram, 0, MAPPER_PRG_RAM_SIZE);
+    std::memset(state.vram, 0, MAPPER_VRAM_SIZE);
+    if(mapper)
+    {
+        std::memcpy(state.mapper, mapper->state_data(), mapper->state_size());
+        if(mapper->chr_ram())
+            std::memcpy(state.chr_ram, mapper->chr_ram(), MAPPER_CHR_RAM_SIZE);
+        if(mapper->prg_ram())
+            std::memcpy(state.prg_ram, mapper->prg_ram(), MAPPER_PRG_RAM_SIZE);
+        if(mapper->vram())
+            std::memcpy(state.vram, mapper->vram(), MAPPER_VRAM_SIZE);
+    }
+}
+
+// Bit i is set for each 256 byte hash_dirty page of size bytes that differs
+static unsigned long long changed_pages(const unsigned char *current, const unsigned char *incoming, size_t size)
+{
+    unsigned long long changed = 0;
+    for(size_t i = 0; i < size / 0x100; i++)
+    {
+        if(std::memcmp(current + i * 0x100, incoming + i * 0x100, 0x100))
+            changed |= 1ULL << i;
+    }
+    return changed;
+}
+
+// Fails, leaving the console alone, if the state was saved from another
+// cartridge. With restore_prg_ram false the cartridge's PRG RAM is left as
+// it is. Only memory that actually changes is marked in hash_dirty and
+// chr_dirty, so restoring a recent state (run-ahead, rewind) doesn't make
+// their consumers start over.
+bool Console::load_state(const SaveState &state, bool restore_prg_ram)
+{
+    if(!check_state_header(state))
+        return false;
+    if(!rom || state.rom_crc != rom->crc || state.rom_mapper != rom->mapper)
+        return false;
+    cpu.hash_dirty |= changed_pages(cpu.ram, state.cpu.ram, CPU_RAM_SIZE);
+    ppu.hash_dirty |= changed_pages(ppu.name_tables, state.ppu.name_tables, sizeof(ppu.name_tables));
+    CPUState &cpu_state = cpu;
+    PPUState &ppu_state = ppu;
+    cpu_state = state.cpu;
+    ppu_state = state.ppu;
+    ppu.map_nametables();
+    if(mapper)
+    {
+        std::memcpy(mapper->state_data(), state.mapper, mapper->state_size());
+        unsigned char *chr_ram = mapper->chr_ram();
+        if(chr_ram)
+        {
+            for(int tile = 0; tile < CHR_RAM_TILES; tile++)
+            {
+                if(std::memcmp(chr_ram + tile * 16, state.chr_ram + tile * 16, 16))
+                {
+                    ppu.chr_dirty[tile >> 6] |= 1ULL << (tile & 63);
+                    ppu.hash_dirty |= 1ULL << (16 + (tile >> 4));
+                }
+            }
+            std::memcpy(chr_ram, state.chr_ram, MAPPER_CHR_RAM_SIZE);
+        }
+        if(mapper->prg_ram() && restore_prg_ram)
+        {
+            cpu.hash_dirty |= changed_pages(mapper->prg_ram(), state.prg_ram, MAPPER_PRG_RAM_SIZE) << 8;
+            std::memcpy(mapper->prg_ram(), state.prg_ram, MAPPER_PRG_RAM_SIZE);
+        }
+        if(mapper->vram())
+        {
+            ppu.hash_dirty |= changed_pages(mapper->vram(), state.vram, MAPPER_VRAM_SIZE) << 8;
+            std::memcpy(mapper->vram(), state.vram, MAPPER_VRAM_SIZE);
+        }
+        mapper->update_banks();
+    }
+    return true;
+}
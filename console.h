@@ -0,0 +1,63 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+#include "battery.h"
+#include "nesfile.h"
+#include "savestate.h"
+#include "profiler.h"
+#include "trace.h"
+
+#include<memory>
+#include<vector>
+#include<string>
+
+// Owns one CPU/PPU pair wired to each other and steps them in lockstep.
+class Console
+{
+public:
+    CPU cpu;
+    PPU ppu;
+    std::shared_ptr<const NESFile> rom;
+    BatteryFile battery;
+    std::unique_ptr<Mapper> mapper;
+    FrameProfiler profiler;
+    FrameTracer tracer; // Used instead of profiler for frames run while tracing
+    std::vector<unsigned char> ahead_prg_ram; // Battery RAM stand-in while running ahead
+    Console();
+    Console(const Console &) = delete;
+    Console &operator=(const Console &) = delete;
+    bool load_cartridge(std::shared_ptr<const NESFile> cartridge, const std::string &save_path = "");
+    bool power_on();
+    void reset();
+    void run_frame(bool render = true);
+    void run_frame_ahead(int frames, SaveState &scratch);
+    void preview_frames(int frames, SaveState &scratch);
+    void save_state(SaveState &state) const;
+    bool load_state(const SaveState &state, bool restore_prg_ram = true);
+    template<class P> void step_frame(P &profiler, bool render);
+};
+
+// Runs until the PPU wraps to the pre-render line of the next frame, calling
+// the profiler's hooks around each CPU cycle. With NoProfiler they compile
+// to nothing.
+template<class P> void Console::step_frame(P &profiler, bool render)
+{
+    int start_frame = ppu.frame;
+    ppu.skip_render = !render;
+    profiler.frame_begin();
+    while(ppu.frame == start_frame)
+    {
+        profiler.ppu_begin(ppu);
+        ppu.do_cycle();
+        ppu.do_cycle();
+        ppu.do_cycle();
+        profiler.cpu_begin(cpu);
+        cpu.do_cycle();
+        profiler.cpu_end(cpu);
+    }
+    profiler.frame_end();
+}
+#endif
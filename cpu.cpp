@@ -1,6 +1,19 @@
 #include "cpu.h"
+#include "mapper.h"
+#include "log.h"
+
+static const unsigned char unmapped_prg[0x2000] = {};
+
 CPU::CPU()
 {
+    CPUState &state = *this;
+    state = CPUState();
+    ppu = nullptr;
+    mapper = nullptr;
+    std::fill(prg_pages, prg_pages+4, &unmapped_prg[0]);
+    prg_ram_page = nullptr;
+    controller_buttons = 0;
+    hash_dirty = ~0ULL;
     // Initial state from https://wiki.nesdev.com/w/index.php/CPU_power_up_state
     A = 0;
     X = 0;
@@ -22,7 +35,7 @@ CPU::CPU()
 
 void CPU::dump_memory(unsigned char *buffer)
 {
-    for(int i = 0; i < CPU_INT_MEMORY_SIZE; i++)
+    for(int i = 0; i < 0x10000; i++)
     {
         buffer[i] = read_memory(i);
     }
@@ -30,10 +43,7 @@ void CPU::dump_memory(unsigned char *buffer)
 
 void CPU::dump_registers()
 {
-    std::cout << std::hex << " A: " << (unsigned short)A;
-    std::cout << std::hex << " X: " << (unsigned short)X ;
-    std::cout << std::hex << " Y: " << (unsigned short)Y;
-    std::cout << std::hex << " S: " << (unsigned short)S << std::endl;
+    NES_LOG(LOG_CPU, LOG_DEBUG, "A: {x} X: {x} Y: {x} S: {x}", A, X, Y, S);
 }
 
 void CPU::update_lda_flags()
@@ -45,7 +55,7 @@ void CPU::update_lda_flags()
 
 void CPU::update_adc_flags(unsigned char arg, unsigned int result)
 {
-    //std::cout << "[ADC] RESULT: 0x" << std::hex << result << std::dec << std::endl;
+    NES_LOG(LOG_CPU, LOG_TRACE, "ADC RESULT {x}", result);
     flags_carry = (result > 0xFF);
     flags_zero = (result & 0xff) == 0;
     flags_overflow = ((A ^ result) & (arg ^ result) & 0x80);
@@ -146,6 +156,25 @@ void CPU::update_ror_flags(unsigned char orig, unsigned char result)
     flags_negative = result & 0x80;
 }
 
+// Pushes PC and the status flags (B clear) and jumps through the vector
+void CPU::interrupt(unsigned short vector)
+{
+    push(PC >> 8);
+    push(PC & 0xff);
+    std::bitset<8> status{};
+    status[0] = flags_carry;
+    status[1] = flags_zero;
+    status[2] = flags_int_disable;
+    status[3] = flags_dec_mode;
+    status[4] = 0;
+    status[5] = 1;
+    status[6] = flags_overflow;
+    status[7] = flags_negative;
+    push((unsigned char)status.to_ulong());
+    flags_int_disable = 1;
+    PC = (read_memory(vector + 1) << 8) + read_memory(vector);
+}
+
 void CPU::do_cycle()
 {
     clocks_remain--;
@@ -153,23 +182,16 @@ void CPU::do_cycle()
 
     if(NMI && clocks_remain < 0)
     {
-        push(PC >> 8);
-        push(PC & 0xff);
-        std::bitset<8> status{};
-        status[0] = flags_carry;
-        status[1] = flags_zero;
-        status[2] = flags_int_disable;
-        status[3] = flags_dec_mode;
-        status[4] = 0;
-        status[5] = 1;
-        status[6] = flags_overflow;
-        status[7] = flags_negative;
-        push((unsigned char)status.to_ulong());
-        flags_int_disable = 1;
-        PC = (read_memory(0xfffb) << 8) + read_memory(0xfffa);
+        interrupt(0xfffa);
         NMI = false;
         ppu->NMI_occurred = false;
     }
+    else if(IRQ && !flags_int_disable && clocks_remain < 0)
+    {
+        // IRQ is level triggered: the source (e.g. the mapper) holds the
+        // line until the handler acknowledges it
+        interrupt(0xfffe);
+    }
     if(oam_write_pending && clocks_remain > 0)
         return;
     else if(oam_write_pending && clocks_remain == 0)
@@ -809,7 +831,7 @@ void CPU::do_cycle()
             {
                 flags_int_disable = 0;
                 PC += 1;
-//                std::cout << "CLI" << std::endl;
+                NES_LOG(LOG_CPU, LOG_TRACE, "CLI");
             }
             break;
         case 0xB8: // CLI
@@ -1180,7 +1202,7 @@ void CPU::do_cycle()
             break;
         case 0xFE: // INC ABSOLUTE,X 
             if(clocks_remain < 0)
-                clocks_remain = 5;
+                clocks_remain = 6;
             else if(clocks_remain == 0)
             {
                 unsigned short addr = get_absolute_address() + X;
@@ -1639,7 +1661,7 @@ void CPU::do_cycle()
             break;
         case 0x3E: // ROL ABSOLUTE,X 
             if(clocks_remain < 0)
-                clocks_remain = 5;
+                clocks_remain = 6;
             else if(clocks_remain == 0)
             {
                 unsigned short addr = get_absolute_address() + X;
@@ -1696,7 +1718,7 @@ void CPU::do_cycle()
                 unsigned short addr = get_absolute_address();
                 unsigned char orig = read_memory(addr);
                 unsigned char result = (orig >> 1) | ((flags_carry << 7) & 0x80);
-                //std::cout << "[ROR] READING FROM 0x" << std::hex << addr << ": " << orig << " BECOMES " << result << std::dec << std::endl;
+                NES_LOG(LOG_CPU, LOG_TRACE, "ROR {x}: {x} BECOMES {x}", addr, orig, result);
                 write_memory(addr, result);
                 PC += 3;
                 update_ror_flags(orig, result);
@@ -1704,7 +1726,7 @@ void CPU::do_cycle()
             break;
         case 0x7E: // ROR ABSOLUTE,X 
             if(clocks_remain < 0)
-                clocks_remain = 5;
+                clocks_remain = 6;
             else if(clocks_remain == 0)
             {
                 unsigned short addr = get_absolute_address() + X;
@@ -1730,7 +1752,7 @@ void CPU::do_cycle()
                 flags_dec_mode = status[3];
                 flags_overflow = status[6];
                 flags_negative = status[7];
-                //std::cout << "[CPU] RETURNING FROM INTERRUPT: JUMPING TO 0x" << std::hex << PC << std::dec << std::endl;
+                NES_LOG(LOG_CPU, LOG_DEBUG, "RETURNING FROM INTERRUPT TO {x}", PC);
             }
             break;
         case 0x60: // RTS
@@ -1827,7 +1849,7 @@ void CPU::do_cycle()
                 unsigned short address = get_absolute_address() + Y;
                 unsigned char arg = ~read_memory(address);
                 unsigned int result = A + arg + flags_carry;
-                //std::cout << "[SBC] READING FROM " << std::hex << address << ": GOT " << ~arg << std::dec << std::endl;
+                NES_LOG(LOG_CPU, LOG_TRACE, "SBC {x}: GOT {x}", address, (unsigned char)~arg);
                 update_adc_flags(arg, result);                             
                 A = result % 256;
                 PC += 3;
@@ -1969,7 +1991,7 @@ void CPU::do_cycle()
             break;
         case 0x96: // STX , ZERO PAGE,Y
             if(clocks_remain < 0)
-                clocks_remain = 2;
+                clocks_remain = 3;
             else if(clocks_remain == 0)
             {
                 unsigned char addr = (read_memory(PC + 1) + Y) % 256;
@@ -1998,7 +2020,7 @@ void CPU::do_cycle()
             break;
         case 0x94: // STY ZERO PAGE,X 
             if(clocks_remain < 0)
-                clocks_remain = 2;
+                clocks_remain = 3;
             else if(clocks_remain == 0)
             {
                 unsigned char addr = (read_memory(PC + 1) + X) % 256;
@@ -2124,117 +2146,147 @@ void CPU::read_memory_chunk(unsigned short addr, unsigned short length, unsigned
 unsigned char CPU::read_memory(unsigned short address)
 {
     unsigned char ret;
+    if(address >= 0x2000 && address < 0x4000)
+        address &= 0x2007; // PPU registers repeat every 8 bytes
     switch(address)
     {
         case 0x2002: // PPUSTATUS
             ret = ppu->PPUSTATUS;
-            //std::cout << "READING PPUSTATUS: 0x" << std::hex << (short)ret << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "READ PPUSTATUS {x}", ret);
             ppu->PPUSTATUS &= ~(1 << 7); // Clear vblank on read
             ppu->NMI_occurred = false;
             ppu->addr_scroll_latch = false;
             break;
         case 0x2004: // OAMDATA
             ret = ppu->OAMDATA; // For now this has no side-effects
-            //std::cout << "READING OAMDATA 0x" << std::hex << (short)ret << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "READ OAMDATA {x}", ret);
             break;
         case 0x2007: // PPUDATA
             ret = ppu->read_data();
-            //std::cout << "READING PPUDATA 0x" << std::hex << (short)ret << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "READ PPUDATA {x}", ret);
             break;
         case 0x4016: // JOYPAD1
             if(!controller_strobe)
             {
-                switch(controller_read_count)
-                {
-                    case 0:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::Z);
-                        break;
-                    case 1:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::X);
-                        break;
-                    case 2:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::Space);
-                        break;
-                    case 3:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::Return);
-                        break;
-                    case 4:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::Up);
-                        break;
-                    case 5:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::Down);
-                        break;
-                    case 6:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::Left);
-                        break;
-                    case 7:
-                        ret = 0x40 | sf::Keyboard::isKeyPressed(sf::Keyboard::Right);
-                        break;
-                }
+                ret = 0x40 | ((controller_buttons >> controller_read_count) & 0x1);
                 controller_read_count += 1;
                 controller_read_count = controller_read_count % 8;
             }
             else
+            {
+                ret = 0x40 | (controller_buttons & 0x1); // Strobe held: keeps reporting A
                 controller_read_count = 0;
+            }
             break;
         default: 
-            ret = int_memory[address];
+            if(address >= 0x8000)
+                ret = prg_pages[(address >> 13) & 0x3][address & 0x1FFF];
+            else if(address >= 0x6000)
+                ret = prg_ram_page ? prg_ram_page[address & 0x1FFF] : 0;
+            else if(address < 0x2000)
+                ret = ram[address & (CPU_RAM_SIZE - 1)];
+            else
+                ret = 0; // Write-only PPU registers, APU and expansion area
     }
     return ret;
 }
 
+// What read_memory would return, without clearing vblank, advancing the
+// PPU address or shifting the controller. For debuggers and profilers.
+unsigned char CPU::peek_memory(unsigned short address) const
+{
+    if(address >= 0x2000 && address < 0x4000)
+        address &= 0x2007;
+    switch(address)
+    {
+        case 0x2002: // PPUSTATUS
+            return ppu->PPUSTATUS;
+        case 0x2004: // OAMDATA
+            return ppu->OAMDATA;
+        case 0x2007: // PPUDATA
+            return ppu->vram_addr > 0x3EFF ? ppu->read_memory(ppu->vram_addr) : ppu->read_buffer;
+        case 0x4016: // JOYPAD1
+            return 0x40 | ((controller_strobe ? controller_buttons : controller_buttons >> controller_read_count) & 0x1);
+    }
+    if(address >= 0x8000)
+        return prg_pages[(address >> 13) & 0x3][address & 0x1FFF];
+    else if(address >= 0x6000)
+        return prg_ram_page ? prg_ram_page[address & 0x1FFF] : 0;
+    else if(address < 0x2000)
+        return ram[address & (CPU_RAM_SIZE - 1)];
+    return 0;
+}
+
 void CPU::write_memory(unsigned short address, unsigned char value)
 {
+    if(address >= 0x2000 && address < 0x4000)
+        address &= 0x2007;
     switch(address)
     {
         case 0x2000: // PPUCTRL
-            //std::cout << "WRITING TO PPUCTRL: 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE PPUCTRL {x}", value);
             ppu->PPUCTRL = value;
             ppu->NMI_output = std::bitset<8>(ppu->PPUCTRL)[7];
             ppu->vram_addr_temp &= ~0xC00;
             ppu->vram_addr_temp |= (value & 0x3) << 10;
             break;
         case 0x2001: // PPUMASK
-            //std::cout << "WRITING TO PPUMASK: 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE PPUMASK {x}", value);
             ppu->PPUMASK = value;
             break;
         case 0x2003: // OAMADDR
-            //std::cout << "WRITING TO OAMADDR: 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE OAMADDR {x}", value);
             ppu->OAMADDR = value;
             break;
         case 0x2004: // OAMDATA
-            //std::cout << "WRITING TO OAMDATA: 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE OAMDATA {x}", value);
             ppu->write_oam(value);
             break;
         case 0x2005: // PPUSCROLL
-            //std::cout << "WRITING TO PPUSCROLL: 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE PPUSCROLL {x}", value);
             // TODO IMPLEMENT PROPERLY
             ppu->write_ppuscroll(value);
             break;
         case 0x2006: // PPUADDR
-            //std::cout << "WRITING TO PPUADDR: 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE PPUADDR {x}", value);
             ppu->update_addr(value);
             break;
         case 0x2007: // PPUDATA
-            //std::cout << "WRITING TO PPUDATA: 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
-            //std::cout << "CURRENT PPU VRAM ADDR: 0x" << std::hex << ppu->vram_addr << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE PPUDATA {x} AT {x}", value, ppu->vram_addr);
             ppu->write_data(value);
             break;
         case 0x4014: // OAMDMA
-            //std::cout << "WRITING TO OAMDMA 0x" << std::hex << (unsigned short)value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE OAMDMA {x}", value);
             oam_write_pending = true;
             ppu->OAMDMA = value;
             clocks_remain = 513;
             break;
         case 0x4016: // JOYPAD1
-            //std::cout << "WROTE JOYPAD1: 0x" << std::hex << (unsigned short) value << std::dec << std::endl;
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE JOYPAD1 {x}", value);
             controller_strobe = value % 2 == 1;
             if(controller_strobe && cycle % 10 == 0)
                 buttons_pressed = !buttons_pressed;
             break;
         default:
-            //std::cout << "Writing at address 0x" << std::hex << address << ": 0x" << (int)value << std::dec << std::endl;
-            int_memory[address] = value;       
+            NES_LOG(LOG_CPU, LOG_TRACE, "WRITE {x}: {x}", address, value);
+            if(address >= 0x8000)
+            {
+                if(mapper)
+                    mapper->write_register(address, value);
+            }
+            else if(address >= 0x6000)
+            {
+                if(prg_ram_page)
+                {
+                    prg_ram_page[address & 0x1FFF] = value;
+                    hash_dirty |= 1ULL << (8 + ((address & 0x1FFF) >> 8));
+                }
+            }
+            else if(address < 0x2000)
+            {
+                ram[address & (CPU_RAM_SIZE - 1)] = value;
+                hash_dirty |= 1ULL << ((address & (CPU_RAM_SIZE - 1)) >> 8);
+            }
     }
 
 }
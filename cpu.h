@@ -13,13 +13,25 @@
 
 #include "ppu.h"
 
-#define CPU_INT_MEMORY_SIZE 0xFFFF
+#define CPU_RAM_SIZE 0x800 // Mirrored through $0000-$1FFF
+
+// Bits of CPU::controller_buttons, in the order the controller shifts them out
+#define BUTTON_A 0x01
+#define BUTTON_B 0x02
+#define BUTTON_SELECT 0x04
+#define BUTTON_START 0x08
+#define BUTTON_UP 0x10
+#define BUTTON_DOWN 0x20
+#define BUTTON_LEFT 0x40
+#define BUTTON_RIGHT 0x80
 
 class PPU;
+class Mapper;
 
-class CPU
+// Everything that makes up the CPU's emulated state, kept as plain data so a
+// snapshot is a single struct copy.
+struct CPUState
 {
-public:
     unsigned char A;
     unsigned char X ;
     unsigned char Y;
@@ -28,7 +40,6 @@ public:
     bool IRQ;
     bool NMI;
     bool oam_write_pending;
-    PPU *ppu;
     bool flags_carry;
     bool flags_zero;
     bool flags_int_disable;
@@ -36,22 +47,35 @@ public:
     bool flags_break;
     bool flags_overflow;
     bool flags_negative;
-    unsigned char int_memory[CPU_INT_MEMORY_SIZE];
+    unsigned char ram[CPU_RAM_SIZE];
     int cycle;
     int clocks_remain;
+    int controller_read_count;
+    bool controller_strobe;
+    bool buttons_pressed;
+};
+
+class CPU : public CPUState
+{
+public:
+    PPU *ppu;
+    Mapper *mapper;
+    const unsigned char *prg_pages[4]; // $8000-$FFFF in 8kb pages, pointed into cartridge PRG by the mapper
+    unsigned char *prg_ram_page; // $6000-$7FFF, nullptr when the cartridge has no PRG RAM
+    unsigned char controller_buttons; // Held buttons, set by the frontend once per frame
+    unsigned long long hash_dirty; // 256 byte pages written since StateHasher last saw them: ram in bits 0-7, PRG RAM in 8-39
     CPU();
     void do_cycle();
+    void interrupt(unsigned short vector);
     void push(unsigned char val);
     unsigned char pull();
     unsigned char read_memory(unsigned short address);
+    unsigned char peek_memory(unsigned short address) const;
     void read_memory_chunk(unsigned short addr, unsigned short length, unsigned char *buffer);
     void write_memory(unsigned short address, unsigned char value);
     void dump_memory(unsigned char *buffer);
 private:
     void dump_registers();
-    int controller_read_count;
-    bool controller_strobe;
-    bool buttons_pressed;
     void update_adc_flags(unsigned char arg, unsigned int result);
     void update_and_flags();
     void update_asl_flags(unsigned char orig, unsigned char result);
@@ -0,0 +1,354 @@
+#include<cstring>
+
+#include "cpulog.h"
+
+enum Mode { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABSX, ABSY, INDX, INDY, REL, IND };
+
+struct Opcode
+{
+    const char *name; // Unofficial opcodes start with '*', as in nestest.log
+    Mode mode;
+};
+
+static const Opcode opcodes[256] =
+{
+    {"BRK", IMP}, {"ORA", INDX}, {"*KIL", IMP}, {"*SLO", INDX}, {"*NOP", ZP}, {"ORA", ZP}, {"ASL", ZP}, {"*SLO", ZP}, {"PHP", IMP}, {"ORA", IMM}, {"ASL", ACC}, {"*ANC", IMM}, {"*NOP", ABS}, {"ORA", ABS}, {"ASL", ABS}, {"*SLO", ABS}, // $00
+    {"BPL", REL}, {"ORA", INDY}, {"*KIL", IMP}, {"*SLO", INDY}, {"*NOP", ZPX}, {"ORA", ZPX}, {"ASL", ZPX}, {"*SLO", ZPX}, {"CLC", IMP}, {"ORA", ABSY}, {"*NOP", IMP}, {"*SLO", ABSY}, {"*NOP", ABSX}, {"ORA", ABSX}, {"ASL", ABSX}, {"*SLO", ABSX}, // $10
+    {"JSR", ABS}, {"AND", INDX}, {"*KIL", IMP}, {"*RLA", INDX}, {"BIT", ZP}, {"AND", ZP}, {"ROL", ZP}, {"*RLA", ZP}, {"PLP", IMP}, {"AND", IMM}, {"ROL", ACC}, {"*ANC", IMM}, {"BIT", ABS}, {"AND", ABS}, {"ROL", ABS}, {"*RLA", ABS}, // $20
+    {"BMI", REL}, {"AND", INDY}, {"*KIL", IMP}, {"*RLA", INDY}, {"*NOP", ZPX}, {"AND", ZPX}, {"ROL", ZPX}, {"*RLA", ZPX}, {"SEC", IMP}, {"AND", ABSY}, {"*NOP", IMP}, {"*RLA", ABSY}, {"*NOP", ABSX}, {"AND", ABSX}, {"ROL", ABSX}, {"*RLA", ABSX}, // $30
+    {"RTI", IMP}, {"EOR", INDX}, {"*KIL", IMP}, {"*SRE", INDX}, {"*NOP", ZP}, {"EOR", ZP}, {"LSR", ZP}, {"*SRE", ZP}, {"PHA", IMP}, {"EOR", IMM}, {"LSR", ACC}, {"*ALR", IMM}, {"JMP", ABS}, {"EOR", ABS}, {"LSR", ABS}, {"*SRE", ABS}, // $40
+    {"BVC", REL}, {"EOR", INDY}, {"*KIL", IMP}, {"*SRE", INDY}, {"*NOP", ZPX}, {"EOR", ZPX}, {"LSR", ZPX}, {"*SRE", ZPX}, {"CLI", IMP}, {"EOR", ABSY}, {"*NOP", IMP}, {"*SRE", ABSY}, {"*NOP", ABSX}, {"EOR", ABSX}, {"LSR", ABSX}, {"*SRE", ABSX}, // $50
+    {"RTS", IMP}, {"ADC", INDX}, {"*KIL", IMP}, {"*RRA", INDX}, {"*NOP", ZP}, {"ADC", ZP}, {"ROR", ZP}, {"*RRA", ZP}, {"PLA", IMP}, {"ADC", IMM}, {"ROR", ACC}, {"*ARR", IMM}, {"JMP", IND}, {"ADC", ABS}, {"ROR", ABS}, {"*RRA", ABS}, // $60
+    {"BVS", REL}, {"ADC", INDY}, {"*KIL", IMP}, {"*RRA", INDY}, {"*NOP", ZPX}, {"ADC", ZPX}, {"ROR", ZPX}, {"*RRA", ZPX}, {"SEI", IMP}, {"ADC", ABSY}, {"*NOP", IMP}, {"*RRA", ABSY}, {"*NOP", ABSX}, {"ADC", ABSX}, {"ROR", ABSX}, {"*RRA", ABSX}, // $70
+    {"*NOP", IMM}, {"STA", INDX}, {"*NOP", IMM}, {"*SAX", INDX}, {"STY", ZP}, {"STA", ZP}, {"STX", ZP}, {"*SAX", ZP}, {"DEY", IMP}, {"*NOP", IMM}, {"TXA", IMP}, {"*XAA", IMM}, {"STY", ABS}, {"STA", ABS}, {"STX", ABS}, {"*SAX", ABS}, // $80
+    {"BCC", REL}, {"STA", INDY}, {"*KIL", IMP}, {"*AHX", INDY}, {"STY", ZPX}, {"STA", ZPX}, {"STX", ZPY}, {"*SAX", ZPY}, {"TYA", IMP}, {"STA", ABSY}, {"TXS", IMP}, {"*TAS", ABSY}, {"*SHY", ABSX}, {"STA", ABSX}, {"*SHX", ABSY}, {"*AHX", ABSY}, // $90
+    {"LDY", IMM}, {"LDA", INDX}, {"LDX", IMM}, {"*LAX", INDX}, {"LDY", ZP}, {"LDA", ZP}, {"LDX", ZP}, {"*LAX", ZP}, {"TAY", IMP}, {"LDA", IMM}, {"TAX", IMP}, {"*LAX", IMM}, {"LDY", ABS}, {"LDA", ABS}, {"LDX", ABS}, {"*LAX", ABS}, // $A0
+    {"BCS", REL}, {"LDA", INDY}, {"*KIL", IMP}, {"*LAX", INDY}, {"LDY", ZPX}, {"LDA", ZPX}, {"LDX", ZPY}, {"*LAX", ZPY}, {"CLV", IMP}, {"LDA", ABSY}, {"TSX", IMP}, {"*LAS", ABSY}, {"LDY", ABSX}, {"LDA", ABSX}, {"LDX", ABSY}, {"*LAX", ABSY}, // $B0
+    {"CPY", IMM}, {"CMP", INDX}, {"*NOP", IMM}, {"*DCP", INDX}, {"CPY", ZP}, {"CMP", ZP}, {"DEC", ZP}, {"*DCP", ZP}, {"INY", IMP}, {"CMP", IMM}, {"DEX", IMP}, {"*AXS", IMM}, {"CPY", ABS}, {"CMP", ABS}, {"DEC", ABS}, {"*DCP", ABS}, // $C0
+    {"BNE", REL}, {"CMP", INDY}, {"*KIL", IMP}, {"*DCP", INDY}, {"*NOP", ZPX}, {"CMP", ZPX}, {"DEC", ZPX}, {"*DCP", ZPX}, {"CLD", IMP}, {"CMP", ABSY}, {"*NOP", IMP}, {"*DCP", ABSY}, {"*NOP", ABSX}, {"CMP", ABSX}, {"DEC", ABSX}, {"*DCP", ABSX}, // $D0
+    {"CPX", IMM}, {"SBC", INDX}, {"*NOP", IMM}, {"*ISB", INDX}, {"CPX", ZP}, {"SBC", ZP}, {"INC", ZP}, {"*ISB", ZP}, {"INX", IMP}, {"SBC", IMM}, {"NOP", IMP}, {"*SBC", IMM}, {"CPX", ABS}, {"SBC", ABS}, {"INC", ABS}, {"*ISB", ABS}, // $E0
+    {"BEQ", REL}, {"SBC", INDY}, {"*KIL", IMP}, {"*ISB", INDY}, {"*NOP", ZPX}, {"SBC", ZPX}, {"INC", ZPX}, {"*ISB", ZPX}, {"SED", IMP}, {"SBC", ABSY}, {"*NOP", IMP}, {"*ISB", ABSY}, {"*NOP", ABSX}, {"SBC", ABSX}, {"INC", ABSX}, {"*ISB", ABSX}, // $F0
+};
+
+static const int operand_bytes[] = {0, 0, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 2};
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static char *put_hex8(char *p, unsigned char value)
+{
+    p[0] = hex_digits[value >> 4];
+    p[1] = hex_digits[value & 0xF];
+    return p + 2;
+}
+
+static char *put_hex16(char *p, unsigned short value)
+{
+    return put_hex8(put_hex8(p, value >> 8), value & 0xFF);
+}
+
+static char *put_str(char *p, const char *text)
+{
+    while(*text)
+        *p++ = *text++;
+    return p;
+}
+
+// Right aligned in width characters, like %3d
+static char *put_dec(char *p, long long value, int width = 0)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while(value > 0);
+    for(int i = count; i < width; i++)
+        *p++ = ' ';
+    while(count > 0)
+        *p++ = digits[--count];
+    return p;
+}
+
+static char *pad_to(char *p, char *start, int column)
+{
+    while(p < start + column)
+        *p++ = ' ';
+    return p;
+}
+
+static unsigned short peek16(const CPU &cpu, unsigned short address)
+{
+    return cpu.peek_memory(address) | (cpu.peek_memory(address + 1) << 8);
+}
+
+// The pointer's high byte comes from the same page or zero page, like the
+// hardware reads it
+static unsigned short peek16_wrapped(const CPU &cpu, unsigned short address)
+{
+    unsigned short high = (address & 0xFF00) | ((address + 1) & 0xFF);
+    return cpu.peek_memory(address) | (cpu.peek_memory(high) << 8);
+}
+
+CPULog::CPULog()
+{
+    limit = 0;
+    lines = 0;
+    mismatch = false;
+    mismatch_line = 0;
+    reference_ended = false;
+    out = nullptr;
+    reference = nullptr;
+    compare_timing = false;
+    used = 0;
+    last_line[0] = 0;
+    scanline = 0;
+    dot = 0;
+    starting = false;
+    start_pc = 0;
+    start_s = 0;
+    start_nmi = false;
+    start_cycle = 0;
+}
+
+CPULog::~CPULog()
+{
+    close();
+}
+
+bool CPULog::open(const std::string &path)
+{
+    out = path == "-" ? stdout : std::fopen(path.c_str(), "wb");
+    buffer.resize(CPU_LOG_BUFFER_SIZE);
+    used = 0;
+    return out != nullptr;
+}
+
+bool CPULog::compare(const std::string &reference_path, bool timing)
+{
+    reference = std::fopen(reference_path.c_str(), "rb");
+    compare_timing = timing;
+    return reference != nullptr;
+}
+
+void CPULog::close()
+{
+    flush();
+    if(out && out != stdout)
+        std::fclose(out);
+    else if(out)
+        std::fflush(out);
+    if(reference)
+        std::fclose(reference);
+    out = nullptr;
+    reference = nullptr;
+}
+
+bool CPULog::done()
+{
+    return mismatch || reference_ended || (limit && lines >= limit);
+}
+
+void CPULog::flush()
+{
+    if(out && used)
+        std::fwrite(buffer.data(), 1, used, out);
+    used = 0;
+}
+
+void CPULog::log_instruction(const CPU &cpu)
+{
+    if(done())
+        return;
+    if(reference && !std::fgets(reference_line, sizeof(reference_line), reference))
+    {
+        reference_ended = true;
+        return;
+    }
+    char scratch[CPU_LOG_LINE_MAX];
+    char *line = out ? buffer.data() + used : scratch;
+    int length = format(cpu, line);
+    line[length] = 0;
+    lines++;
+    if(reference)
+        check(line, length);
+    if(out)
+    {
+        used += length;
+        buffer[used++] = '\n';
+        if(used + CPU_LOG_LINE_MAX > buffer.size())
+            flush();
+    }
+}
+
+int CPULog::format(const CPU &cpu, char *line)
+{
+    // The CPU services interrupts in the cycle it would have fetched the
+    // next opcode and fetches the handler's first instruction right away.
+    // Unknown opcodes move PC in that cycle too, so start_pc is used
+    // otherwise.
+    unsigned short pc = start_pc;
+    if(cpu.S != start_s)
+        pc = peek16(cpu, start_nmi ? 0xFFFA : 0xFFFE);
+    unsigned char opcode = cpu.peek_memory(pc);
+    const Opcode &op = opcodes[opcode];
+    unsigned char low = cpu.peek_memory(pc + 1);
+    unsigned char high = cpu.peek_memory(pc + 2);
+    unsigned short operand = low | (high << 8);
+
+    char *p = put_hex16(line, pc);
+    p = put_str(p, "  ");
+    p = put_hex8(p, opcode);
+    *p++ = ' ';
+    if(operand_bytes[op.mode] >= 1)
+    {
+        p = put_hex8(p, low);
+        *p++ = ' ';
+    }
+    if(operand_bytes[op.mode] >= 2)
+    {
+        p = put_hex8(p, high);
+        *p++ = ' ';
+    }
+    p = pad_to(p, line, 15);
+    char *disassembly = p;
+    if(op.name[0] != '*')
+        *p++ = ' ';
+    p = put_str(p, op.name);
+    *p++ = ' ';
+
+    unsigned short address;
+    switch(op.mode)
+    {
+        case IMP:
+            p--;
+            break;
+        case ACC:
+            *p++ = 'A';
+            break;
+        case IMM:
+            p = put_str(p, "#$");
+            p = put_hex8(p, low);
+            break;
+        case ZP:
+            *p++ = '$';
+            p = put_hex8(p, low);
+            p = put_str(p, " = ");
+            p = put_hex8(p, cpu.peek_memory(low));
+            break;
+        case ZPX:
+        case ZPY:
+            address = (low + (op.mode == ZPX ? cpu.X : cpu.Y)) & 0xFF;
+            *p++ = '$';
+            p = put_hex8(p, low);
+            p = put_str(p, op.mode == ZPX ? ",X @ " : ",Y @ ");
+            p = put_hex8(p, address);
+            p = put_str(p, " = ");
+            p = put_hex8(p, cpu.peek_memory(address));
+            break;
+        case ABS:
+            *p++ = '$';
+            p = put_hex16(p, operand);
+            if(opcode != 0x4C && opcode != 0x20) // JMP and JSR don't read their operand
+            {
+                p = put_str(p, " = ");
+                p = put_hex8(p, cpu.peek_memory(operand));
+            }
+            break;
+        case ABSX:
+        case ABSY:
+            address = operand + (op.mode == ABSX ? cpu.X : cpu.Y);
+            *p++ = '$';
+            p = put_hex16(p, operand);
+            p = put_str(p, op.mode == ABSX ? ",X @ " : ",Y @ ");
+            p = put_hex16(p, address);
+            p = put_str(p, " = ");
+            p = put_hex8(p, cpu.peek_memory(address));
+            break;
+        case INDX:
+            address = peek16_wrapped(cpu, (low + cpu.X) & 0xFF);
+            p = put_str(p, "($");
+            p = put_hex8(p, low);
+            p = put_str(p, ",X) @ ");
+            p = put_hex8(p, (low + cpu.X) & 0xFF);
+            p = put_str(p, " = ");
+            p = put_hex16(p, address);
+            p = put_str(p, " = ");
+            p = put_hex8(p, cpu.peek_memory(address));
+            break;
+        case INDY:
+            address = peek16_wrapped(cpu, low);
+            p = put_str(p, "($");
+            p = put_hex8(p, low);
+            p = put_str(p, "),Y = ");
+            p = put_hex16(p, address);
+            p = put_str(p, " @ ");
+            p = put_hex16(p, address + cpu.Y);
+            p = put_str(p, " = ");
+            p = put_hex8(p, cpu.peek_memory(address + cpu.Y));
+            break;
+        case REL:
+            *p++ = '$';
+            p = put_hex16(p, pc + 2 + (signed char)low);
+            break;
+        case IND:
+            p = put_str(p, "($");
+            p = put_hex16(p, operand);
+            p = put_str(p, ") = ");
+            p = put_hex16(p, peek16_wrapped(cpu, operand));
+            break;
+    }
+    p = pad_to(p, disassembly, 33);
+
+    unsigned char status = cpu.flags_carry | (cpu.flags_zero << 1) | (cpu.flags_int_disable << 2) | (cpu.flags_dec_mode << 3)
+        | 0x20 | (cpu.flags_overflow << 6) | (cpu.flags_negative << 7);
+    p = put_str(p, "A:");
+    p = put_hex8(p, cpu.A);
+    p = put_str(p, " X:");
+    p = put_hex8(p, cpu.X);
+    p = put_str(p, " Y:");
+    p = put_hex8(p, cpu.Y);
+    p = put_str(p, " P:");
+    p = put_hex8(p, status);
+    p = put_str(p, " SP:");
+    p = put_hex8(p, cpu.S & 0xFF);
+    p = put_str(p, " PPU:");
+    p = put_dec(p, scanline, 3);
+    *p++ = ',';
+    p = put_dec(p, dot, 3);
+    p = put_str(p, " CYC:");
+    p = put_dec(p, start_cycle);
+    return p - line;
+}
+
+// Without compare_timing only the text before " PPU:" (or " CYC:" in logs
+// that have no PPU column) has to match
+static int compared_length(const char *line, int length)
+{
+    const char *end = std::strstr(line, " PPU:");
+    if(!end)
+        end = std::strstr(line, " CYC:");
+    return end && end < line + length ? end - line : length;
+}
+
+void CPULog::check(const char *line, int length)
+{
+    int reference_length = std::strcspn(reference_line, "\r\n");
+    reference_line[reference_length] = 0;
+    int compare_length = length;
+    if(!compare_timing)
+    {
+        reference_length = compared_length(reference_line, reference_length);
+        compare_length = compared_length(line, length);
+    }
+    if(compare_length != reference_length || std::memcmp(line, reference_line, compare_length) != 0)
+    {
+        mismatch = true;
+        mismatch_line = lines;
+        expected = reference_line;
+        got = line;
+        previous = last_line;
+        return;
+    }
+    std::memcpy(last_line, line, length + 1);
+}
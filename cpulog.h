@@ -0,0 +1,93 @@
+#ifndef CPULOG_H
+#define CPULOG_H
+
+#include<cstdio>
+#include<string>
+#include<vector>
+
+#include "cpu.h"
+#include "ppu.h"
+
+#define CPU_LOG_LINE_MAX 128
+#define CPU_LOG_BUFFER_SIZE (4 << 20)
+
+// Writes one line per executed instruction in the format of nestest.log:
+//
+//   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+//
+// and/or checks each line against a reference log as it goes, stopping at
+// the first line that differs. Pass it to Console::step_frame as the
+// profiler. Lines are formatted with table driven hex into a buffer that is
+// reused for the whole run, so tracing millions of instructions allocates
+// nothing and never touches iostreams.
+//
+// Operands and the "= value" annotations are read with CPU::peek_memory, so
+// tracing has no side effects on the machine. Only the PPU and CYC columns
+// depend on the emulator's timing model, and they are left out of the
+// comparison unless compare_timing is set.
+class CPULog
+{
+public:
+    CPULog();
+    ~CPULog();
+    CPULog(const CPULog &) = delete;
+    CPULog &operator=(const CPULog &) = delete;
+    bool open(const std::string &path); // "-" writes to stdout
+    bool compare(const std::string &reference_path, bool timing = false);
+    void close();
+    bool done(); // The reference ran out or differed, or the limit was reached
+
+    long long limit; // Stop after this many instructions, 0 for no limit
+    long long lines; // Instructions logged so far
+    bool mismatch;
+    long long mismatch_line; // 1 based, valid when mismatch is set
+    std::string expected; // The reference line that differed
+    std::string got;
+    std::string previous; // The last line that still matched
+    bool reference_ended;
+
+    void frame_begin() {}
+    void frame_end() {}
+    void ppu_begin(const PPU &ppu)
+    {
+        scanline = ppu.scanline < 0 ? 261 : ppu.scanline;
+        dot = ppu.dot;
+    }
+    void cpu_begin(const CPU &cpu)
+    {
+        starting = cpu.clocks_remain <= 0 && !cpu.oam_write_pending;
+        if(starting)
+        {
+            start_pc = cpu.PC;
+            start_s = cpu.S;
+            start_nmi = cpu.NMI;
+            start_cycle = cpu.cycle;
+        }
+    }
+    void cpu_end(const CPU &cpu)
+    {
+        if(starting && (out || reference))
+            log_instruction(cpu);
+    }
+private:
+    void log_instruction(const CPU &cpu);
+    int format(const CPU &cpu, char *line);
+    void check(const char *line, int length);
+    void flush();
+
+    FILE *out;
+    FILE *reference;
+    bool compare_timing;
+    std::vector<char> buffer;
+    size_t used;
+    char reference_line[CPU_LOG_LINE_MAX * 2];
+    char last_line[CPU_LOG_LINE_MAX];
+    int scanline;
+    int dot;
+    bool starting;
+    unsigned short start_pc;
+    unsigned short start_s;
+    bool start_nmi;
+    int start_cycle;
+};
+#endif
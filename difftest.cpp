@@ -0,0 +1,414 @@
+#include<iostream>
+#include<string>
+#include<vector>
+#include<memory>
+#include<chrono>
+#include<algorithm>
+#include<cstddef>
+#include<cstdio>
+
+#include "console.h"
+#include "nesfile.h"
+#include "romdb.h"
+#include "savestate.h"
+#include "statehash.h"
+#include "workpool.h"
+#include "screenshot.h"
+
+#define FRAME_CPU_CYCLES 29781 // 341 * 262 / 3, rounded up
+
+// Differential tester. Runs a reference console (plain cycle-stepped
+// run_frame with rendering) and a candidate console configured by a variant
+// side by side on the same ROM and input, comparing state hashes every frame
+// or every N instructions. On a mismatch it replays from the last matching
+// point, bisects to the first instruction after which the two differ, and
+// prints (and optionally saves) both states. New fast paths get checked by
+// adding a variant here.
+//
+// Only architectural state is compared (state_fields in savestate.h): the
+// PPU's per-line render scratch is left out, since skipping rendering
+// legitimately stops maintaining it. What that scratch leaves behind shows up
+// on screen instead, so in per-frame mode PPU::buffer is compared too on
+// frames both sides rendered.
+
+struct Variant
+{
+    const char *name;
+    const char *description;
+    void (*frame)(Console &console, SaveState &scratch);
+    void (*instruction)(Console &console, SaveState &scratch);
+    bool shows_frame; // PPU::buffer holds the frame just run whenever frame() renders it
+};
+
+// Runs cycles until the CPU finishes an instruction. OAM DMA stall cycles
+// belong to the instruction that wrote $4014.
+static void step_instruction(Console &console)
+{
+    CPU &cpu = console.cpu;
+    PPU &ppu = console.ppu;
+    while(true)
+    {
+        bool in_dma = cpu.oam_write_pending;
+        ppu.do_cycle();
+        ppu.do_cycle();
+        ppu.do_cycle();
+        cpu.do_cycle();
+        if(!in_dma && (cpu.clocks_remain <= 0 || cpu.oam_write_pending))
+            return;
+    }
+}
+
+static void roundtrip(Console &console, SaveState &scratch)
+{
+    console.save_state(scratch);
+    console.load_state(scratch);
+}
+
+static const Variant variants[] =
+{
+    {"reference", "the reference itself, to check the harness",
+        [](Console &console, SaveState &) { console.run_frame(); },
+        [](Console &console, SaveState &) { console.ppu.skip_render = false; step_instruction(console); }, true},
+    {"skip-render", "frames run without composing pixels, every fourth one shown",
+        [](Console &console, SaveState &) { console.run_frame(console.ppu.frame % 4 == 3); },
+        [](Console &console, SaveState &) { console.ppu.skip_render = true; step_instruction(console); }, true},
+    {"state-roundtrip", "a save and load after every step",
+        [](Console &console, SaveState &scratch) { console.run_frame(); roundtrip(console, scratch); },
+        [](Console &console, SaveState &scratch) { console.ppu.skip_render = false; step_instruction(console); roundtrip(console, scratch); }, true},
+    {"run-ahead", "two frames of run-ahead, rewound every frame",
+        [](Console &console, SaveState &scratch) { console.run_frame_ahead(2, scratch); },
+        [](Console &console, SaveState &scratch) { console.ppu.skip_render = false; step_instruction(console); roundtrip(console, scratch); }, false},
+};
+
+static std::string hex(unsigned long long value)
+{
+    char text[24];
+    std::snprintf(text, sizeof(text), "0x%llx", value);
+    return text;
+}
+
+static unsigned long long field_value(const SaveState &state, const StateField &field)
+{
+    unsigned long long value = 0;
+    const unsigned char *bytes = (const unsigned char *)&state + field.offset;
+    for(size_t i = 0; i < field.size && i < 8; i++)
+        value |= (unsigned long long)bytes[i] << (i * 8);
+    return value;
+}
+
+// One line per field that differs; arrays list their first few differing bytes
+static std::string describe_diff(const SaveState &reference, const SaveState &candidate)
+{
+    std::string report;
+    for(int i = 0; i < state_field_count; i++)
+    {
+        const StateField &field = state_fields[i];
+        const unsigned char *a = (const unsigned char *)&reference + field.offset;
+        const unsigned char *b = (const unsigned char *)&candidate + field.offset;
+        if(field.size <= 4)
+        {
+            if(field_value(reference, field) != field_value(candidate, field))
+                report += std::string("  ") + field.name + ": reference " + hex(field_value(reference, field)) + " candidate " + hex(field_value(candidate, field)) + "\n";
+            continue;
+        }
+        int differing = 0;
+        std::string examples;
+        for(size_t i = 0; i < field.size; i++)
+        {
+            if(a[i] == b[i])
+                continue;
+            if(differing++ < 8)
+                examples += " [" + hex(i) + "] " + hex(a[i]) + "/" + hex(b[i]);
+        }
+        if(differing)
+            report += std::string("  ") + field.name + ": " + std::to_string(differing) + " bytes differ (reference/candidate)" + examples + (differing > 8 ? " ..." : "") + "\n";
+    }
+    return report;
+}
+
+// The same pseudo-random buttons for a given frame on both consoles, so a
+// replay from any point sees the same input
+static unsigned char input_for_frame(unsigned long long seed, int frame)
+{
+    if(!seed)
+        return 0;
+    unsigned long long x = (seed + frame / 8) * 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 32;
+    return frame % 8 < 6 ? x : 0; // Held for a few frames at a time, like a player would
+}
+
+struct Side
+{
+    std::unique_ptr<Console> console;
+    std::vector<unsigned char> buffer;
+    std::unique_ptr<SaveState> scratch;
+    std::unique_ptr<SaveState> good; // State at the last point where both sides matched
+    std::unique_ptr<SaveState> now;
+    Side() : console(new Console), buffer(SCREEN_WIDTH * SCREEN_HEIGHT * 4), scratch(new SaveState), good(new SaveState), now(new SaveState)
+    {
+        console->ppu.buffer = buffer.data();
+    }
+};
+
+struct Options
+{
+    int frames;
+    int every; // Instructions between comparisons, 0 compares once per frame
+    unsigned long long seed;
+    std::string dump_dir;
+};
+
+struct DiffResult
+{
+    bool ok;
+    std::string error;
+    std::string report;
+    int frames;
+    double seconds;
+};
+
+static unsigned long long snapshot(Side &side)
+{
+    side.console->save_state(*side.now);
+    return hash_state(*side.now);
+}
+
+// Restores both sides to their last matching state and runs count
+// instructions on each. Returns true if they still match.
+static bool replay(Side &reference, Side &candidate, const Variant &variant, long long count, unsigned long long seed)
+{
+    const Variant &plain = variants[0];
+    reference.console->load_state(*reference.good);
+    candidate.console->load_state(*candidate.good);
+    for(long long i = 0; i < count; i++)
+    {
+        reference.console->cpu.controller_buttons = input_for_frame(seed, reference.console->ppu.frame);
+        candidate.console->cpu.controller_buttons = input_for_frame(seed, candidate.console->ppu.frame);
+        plain.instruction(*reference.console, *reference.scratch);
+        variant.instruction(*candidate.console, *candidate.scratch);
+    }
+    return snapshot(reference) == snapshot(candidate);
+}
+
+static std::string base_name(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Called with both sides' good states matching and the step after them
+// diverging. upper bounds the instructions in that step.
+static std::string bisect(Side &reference, Side &candidate, const Variant &variant, long long upper, const std::string &rom_path, const Options &options)
+{
+    int frame = reference.good->ppu.frame;
+    char line[160];
+    std::string report;
+    if(replay(reference, candidate, variant, upper, options.seed))
+    {
+        // Only the variant's frame path diverges, so report the frame level difference
+        reference.console->load_state(*reference.good);
+        candidate.console->load_state(*candidate.good);
+        reference.console->cpu.controller_buttons = candidate.console->cpu.controller_buttons = input_for_frame(options.seed, frame);
+        variants[0].frame(*reference.console, *reference.scratch);
+        variant.frame(*candidate.console, *candidate.scratch);
+        snapshot(reference);
+        snapshot(candidate);
+        std::snprintf(line, sizeof(line), "  frame %d: instruction stepping doesn't reproduce it, difference after the whole frame:\n", frame);
+        report = line;
+    }
+    else
+    {
+        long long lo = 0, hi = upper; // Match after lo instructions, differ after hi
+        while(hi - lo > 1)
+        {
+            long long mid = lo + (hi - lo) / 2;
+            if(replay(reference, candidate, variant, mid, options.seed))
+                lo = mid;
+            else
+                hi = mid;
+        }
+        replay(reference, candidate, variant, lo, options.seed);
+        const CPU &cpu = reference.console->cpu;
+        const PPU &ppu = reference.console->ppu;
+        std::snprintf(line, sizeof(line), "  last match: frame %d scanline %d dot %d\n", frame, reference.good->ppu.scanline, reference.good->ppu.dot);
+        report = line;
+        std::snprintf(line, sizeof(line), "  first differing instruction: #%lld after that, PC $%04X opcode $%02X at scanline %d dot %d\n",
+            hi, cpu.PC, cpu.peek_memory(cpu.PC), ppu.scanline, ppu.dot);
+        report += line;
+        replay(reference, candidate, variant, hi, options.seed);
+    }
+    report += describe_diff(*reference.now, *candidate.now);
+    if(!options.dump_dir.empty())
+    {
+        std::string prefix = options.dump_dir + "/" + base_name(rom_path) + "." + variant.name;
+        if(write_state_file(prefix + ".reference.state", *reference.now) && write_state_file(prefix + ".candidate.state", *candidate.now))
+            report += "  states saved to " + prefix + ".{reference,candidate}.state\n";
+    }
+    return report;
+}
+
+// For a frame whose state matched but whose picture didn't
+static std::string describe_frame_diff(const Side &reference, const Side &candidate, int frame, const std::string &rom_path, const Variant &variant, const Options &options)
+{
+    int differing = 0, first = -1;
+    for(size_t i = 0; i < reference.buffer.size(); i += 4)
+    {
+        if(std::equal(&reference.buffer[i], &reference.buffer[i] + 3, &candidate.buffer[i]))
+            continue;
+        if(first < 0)
+            first = i / 4;
+        differing++;
+    }
+    char line[160];
+    std::snprintf(line, sizeof(line), "  frame %d: state matches but %d pixels differ, the first at x %d y %d\n",
+        frame, differing, first % SCREEN_WIDTH, first / SCREEN_WIDTH);
+    std::string report = line;
+    if(!options.dump_dir.empty())
+    {
+        std::string prefix = options.dump_dir + "/" + base_name(rom_path) + "." + variant.name;
+        if(write_png(prefix + ".reference.png", reference.buffer.data()) && write_png(prefix + ".candidate.png", candidate.buffer.data()))
+            report += "  frames saved to " + prefix + ".{reference,candidate}.png\n";
+    }
+    return report;
+}
+
+static DiffResult run_diff(const std::string &rom_path, std::shared_ptr<const NESFile> rom, const Variant &variant, const Options &options)
+{
+    DiffResult result = {};
+    auto start = std::chrono::steady_clock::now();
+    Side reference, candidate;
+    if(!reference.console->load_cartridge(rom) || !candidate.console->load_cartridge(rom))
+    {
+        result.error = rom->valid ? "unsupported mapper " + std::to_string(rom->mapper) : rom->error;
+        return result;
+    }
+    reference.console->save_state(*reference.good);
+    candidate.console->save_state(*candidate.good);
+    result.ok = true;
+    const Variant &plain = variants[0];
+    while(reference.console->ppu.frame < options.frames)
+    {
+        long long upper = options.every;
+        int frame = reference.console->ppu.frame;
+        if(options.every)
+        {
+            for(int i = 0; i < options.every; i++)
+            {
+                reference.console->cpu.controller_buttons = input_for_frame(options.seed, reference.console->ppu.frame);
+                candidate.console->cpu.controller_buttons = input_for_frame(options.seed, candidate.console->ppu.frame);
+                plain.instruction(*reference.console, *reference.scratch);
+                variant.instruction(*candidate.console, *candidate.scratch);
+            }
+        }
+        else
+        {
+            reference.console->cpu.controller_buttons = candidate.console->cpu.controller_buttons = input_for_frame(options.seed, frame);
+            plain.frame(*reference.console, *reference.scratch);
+            variant.frame(*candidate.console, *candidate.scratch);
+            upper = FRAME_CPU_CYCLES + 1; // Every instruction takes at least a cycle
+        }
+        if(snapshot(reference) != snapshot(candidate))
+        {
+            result.ok = false;
+            result.report = bisect(reference, candidate, variant, upper, rom_path, options);
+            break;
+        }
+        if(!options.every && variant.shows_frame && !candidate.console->ppu.skip_render && reference.buffer != candidate.buffer)
+        {
+            result.ok = false;
+            result.report = describe_frame_diff(reference, candidate, frame, rom_path, variant, options);
+            break;
+        }
+        std::swap(reference.good, reference.now);
+        std::swap(candidate.good, candidate.now);
+    }
+    result.frames = reference.good->ppu.frame;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> rom_paths;
+    std::string variant_name = "all";
+    std::string db_path;
+    int threads = 0;
+    Options options = {600, 0, 1, ""};
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--variant" && i + 1 < argc)
+            variant_name = argv[++i];
+        else if(arg == "--frames" && i + 1 < argc)
+            options.frames = std::stoi(argv[++i]);
+        else if(arg == "--every" && i + 1 < argc)
+            options.every = std::max(0, std::stoi(argv[++i]));
+        else if(arg == "--seed" && i + 1 < argc)
+            options.seed = std::stoull(argv[++i]);
+        else if(arg == "--dump-dir" && i + 1 < argc)
+            options.dump_dir = argv[++i];
+        else if(arg == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if(arg == "--db" && i + 1 < argc)
+            db_path = argv[++i];
+        else
+            rom_paths.push_back(arg);
+    }
+    std::vector<const Variant *> selected;
+    for(const Variant &variant : variants)
+    {
+        if(variant_name == variant.name || (variant_name == "all" && &variant != &variants[0]))
+            selected.push_back(&variant);
+    }
+    if(rom_paths.empty() || selected.empty())
+    {
+        std::cout << "Usage: " << argv[0] << " [--variant NAME|all] [--frames N] [--every INSTRUCTIONS] [--seed N (0 for no input)]"
+            << " [--dump-dir DIR] [--threads N] [--db nes.db] rom.nes..." << std::endl;
+        std::cout << "Variants:" << std::endl;
+        for(const Variant &variant : variants)
+            std::cout << "  " << variant.name << ": " << variant.description << std::endl;
+        return 1;
+    }
+    RomDB db;
+    if(!db_path.empty() && !db.load(db_path))
+        std::cout << "CAN'T LOAD DB " << db_path << std::endl;
+    std::vector<std::shared_ptr<const NESFile>> roms;
+    for(const std::string &path : rom_paths)
+        roms.push_back(NESFile::shared(path, &db));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<DiffResult> results(rom_paths.size() * selected.size());
+    {
+        WorkPool pool(threads);
+        threads = pool.size();
+        for(size_t i = 0; i < results.size(); i++)
+        {
+            pool.submit([&, i](int)
+            {
+                size_t rom = i / selected.size();
+                results[i] = run_diff(rom_paths[rom], roms[rom], *selected[i % selected.size()], options);
+            });
+        }
+        pool.wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const DiffResult &result = results[i];
+        const std::string &path = rom_paths[i / selected.size()];
+        const char *name = selected[i % selected.size()]->name;
+        if(!result.error.empty())
+            std::cout << "ERROR " << path << " [" << name << "]: " << result.error << std::endl;
+        else if(result.ok)
+            std::cout << "MATCH " << path << " [" << name << "] " << result.frames << " FRAMES IN " << result.seconds << "s" << std::endl;
+        else
+            std::cout << "DIVERGED " << path << " [" << name << "] AFTER " << result.frames << " MATCHING FRAMES" << std::endl << result.report;
+        failed += !result.ok;
+    }
+    std::cout << "COMPARED " << results.size() << " RUNS (" << failed << " FAILED) IN " << seconds << "s ON " << threads << " THREADS" << std::endl;
+    return failed ? 1 : 0;
+}
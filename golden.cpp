@@ -0,0 +1,373 @@
+#include<iostream>
+#include<fstream>
+#include<sstream>
+#include<string>
+#include<vector>
+#include<map>
+#include<tuple>
+#include<memory>
+#include<chrono>
+#include<algorithm>
+#include<cstdio>
+#include<cstring>
+
+#include "console.h"
+#include "nesfile.h"
+#include "romdb.h"
+#include "hash.h"
+#include "screenshot.h"
+#include "movie.h"
+#include "workpool.h"
+
+// Golden frame regression suite, for catching rendering changes across many
+// games at once. A suite file has one job per line:
+//
+//   rom.nes frames=60,300,1200 [movie=run.fm2]
+//
+// Each job runs headless with the movie's input (none once it runs out),
+// renders just the listed frames and hashes PPU::buffer after each. The
+// hashes are checked against a golden file of "rom movie frame hash" lines,
+// movie being - when there is none; --update writes this run's hashes into
+// it instead. Every frame that differs is saved as a PNG, along with a diff
+// against the reference image when --images has one (--update --images DIR
+// saves them).
+
+#define FRAME_BYTES (SCREEN_WIDTH * SCREEN_HEIGHT * 4)
+
+struct GoldenJob
+{
+    int line;
+    std::string rom;
+    std::string movie;
+    std::vector<int> frames; // Sorted
+};
+
+struct FrameResult
+{
+    int frame;
+    unsigned long long hash;
+    unsigned long long expected; // The golden hash, 0 when new
+    std::string outcome; // match, differs or new
+    std::string images; // What was written for a frame that didn't match
+};
+
+struct GoldenResult
+{
+    std::string error;
+    std::vector<FrameResult> frames;
+    double seconds;
+};
+
+typedef std::tuple<std::string, std::string, int> GoldenKey; // rom, movie, frame
+
+// Scratch that stays allocated for every job a worker runs
+struct Worker
+{
+    std::unique_ptr<Console> console;
+    std::vector<unsigned char> buffer;
+    std::vector<unsigned char> reference;
+    std::vector<unsigned char> diff;
+    std::vector<unsigned char> movie;
+    Worker() : console(new Console), buffer(FRAME_BYTES), reference(FRAME_BYTES), diff(FRAME_BYTES)
+    {
+        console->ppu.buffer = buffer.data();
+    }
+};
+
+static bool parse_golden_job(const std::string &line, int line_number, GoldenJob &job, std::string &error)
+{
+    std::istringstream in(line);
+    job.line = line_number;
+    if(!(in >> job.rom))
+    {
+        error = "expected: rom frames=N,... [movie=run.fm2]";
+        return false;
+    }
+    std::string token;
+    while(in >> token)
+    {
+        size_t equals = token.find('=');
+        std::string key = token.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : token.substr(equals + 1);
+        std::istringstream list(value);
+        std::string item;
+        if(key == "movie")
+            job.movie = value;
+        else if(key == "frames")
+        {
+            while(std::getline(list, item, ','))
+                job.frames.push_back(std::stoi(item));
+        }
+        else
+        {
+            error = "unknown key " + key;
+            return false;
+        }
+    }
+    std::sort(job.frames.begin(), job.frames.end());
+    job.frames.erase(std::unique(job.frames.begin(), job.frames.end()), job.frames.end());
+    if(job.frames.empty() || job.frames[0] < 1)
+    {
+        error = "frames= needs frame numbers from 1 up";
+        return false;
+    }
+    return true;
+}
+
+static bool load_golden(const std::string &path, std::map<GoldenKey, unsigned long long> &golden)
+{
+    std::ifstream in(path);
+    if(!in)
+        return false;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string rom, movie;
+        int frame;
+        unsigned long long hash;
+        if(line.empty() || line[0] == '#' || !(fields >> rom >> movie >> frame >> std::hex >> hash))
+            continue;
+        golden[std::make_tuple(rom, movie == "-" ? "" : movie, frame)] = hash;
+    }
+    return true;
+}
+
+static bool save_golden(const std::string &path, const std::map<GoldenKey, unsigned long long> &golden)
+{
+    std::ofstream out(path);
+    char hash[17];
+    out << "# rom movie frame hash, written by golden --update\n";
+    for(const auto &entry : golden)
+    {
+        const std::string &movie = std::get<1>(entry.first);
+        std::snprintf(hash, sizeof(hash), "%016llx", entry.second);
+        out << std::get<0>(entry.first) << " " << (movie.empty() ? "-" : movie) << " " << std::get<2>(entry.first) << " " << hash << "\n";
+    }
+    return (bool)out;
+}
+
+static std::string stem(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    return name.substr(0, name.find_last_of('.'));
+}
+
+static std::string image_name(const GoldenJob &job, int frame)
+{
+    return stem(job.rom) + (job.movie.empty() ? "" : "_" + stem(job.movie)) + "_frame" + std::to_string(frame);
+}
+
+// Changed pixels in red over a dimmed grey copy of the reference
+static void make_diff(const unsigned char *actual, const unsigned char *reference, unsigned char *diff)
+{
+    for(int i = 0; i < FRAME_BYTES; i += 4)
+    {
+        bool changed = actual[i] != reference[i] || actual[i + 1] != reference[i + 1] || actual[i + 2] != reference[i + 2];
+        unsigned char grey = (reference[i] + reference[i + 1] + reference[i + 2]) / 9;
+        diff[i] = changed ? 255 : grey;
+        diff[i + 1] = changed ? 0 : grey;
+        diff[i + 2] = changed ? 0 : grey;
+        diff[i + 3] = 255;
+    }
+}
+
+static GoldenResult run_golden_job(const GoldenJob &job, std::shared_ptr<const NESFile> rom, Worker &worker,
+    const std::map<GoldenKey, unsigned long long> &golden, bool update, const std::string &images_dir, const std::string &out_dir)
+{
+    GoldenResult result;
+    result.seconds = 0;
+    auto start = std::chrono::steady_clock::now();
+    worker.movie.clear();
+    if(!job.movie.empty() && !load_movie(job.movie, worker.movie))
+    {
+        result.error = "can't read movie " + job.movie;
+        return result;
+    }
+    Console &console = *worker.console;
+    if(!console.load_cartridge(rom))
+    {
+        result.error = rom->valid ? "unsupported mapper " + std::to_string(rom->mapper) : rom->error;
+        return result;
+    }
+    std::fill(worker.buffer.begin(), worker.buffer.end(), 0); // Nothing left over from the worker's last job
+    size_t next = 0;
+    for(int frame = 1; next < job.frames.size(); frame++)
+    {
+        console.cpu.controller_buttons = frame - 1 < (int)worker.movie.size() ? worker.movie[frame - 1] : 0;
+        bool check = frame == job.frames[next];
+        console.run_frame(check);
+        if(!check)
+            continue;
+        next++;
+        auto expected = golden.find(std::make_tuple(job.rom, job.movie, frame));
+        FrameResult checked = {frame, xxh64(worker.buffer.data(), FRAME_BYTES), expected == golden.end() ? 0 : expected->second, "match", ""};
+        std::string name = image_name(job, frame);
+        if(update)
+        {
+            if(!images_dir.empty() && !write_ppm(images_dir + "/" + name + ".ppm", worker.buffer.data()))
+                checked.images = "can't write " + images_dir + "/" + name + ".ppm";
+        }
+        else if(expected == golden.end() || expected->second != checked.hash)
+        {
+            checked.outcome = expected == golden.end() ? "new" : "differs";
+            std::string path = out_dir + "/" + name + ".png";
+            checked.images = write_png(path, worker.buffer.data()) ? path : "can't write " + path;
+            if(!images_dir.empty() && read_ppm(images_dir + "/" + name + ".ppm", worker.reference.data()))
+            {
+                make_diff(worker.buffer.data(), worker.reference.data(), worker.diff.data());
+                path = out_dir + "/" + name + "_diff.png";
+                checked.images += write_png(path, worker.diff.data()) ? " " + path : " can't write " + path;
+            }
+        }
+        result.frames.push_back(checked);
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *suite_path = nullptr;
+    std::string golden_path;
+    std::string images_dir;
+    std::string out_dir = ".";
+    std::string db_path;
+    int threads = 0;
+    bool update = false;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--golden" && i + 1 < argc)
+            golden_path = argv[++i];
+        else if(arg == "--images" && i + 1 < argc)
+            images_dir = argv[++i];
+        else if(arg == "--out-dir" && i + 1 < argc)
+            out_dir = argv[++i];
+        else if(arg == "--db" && i + 1 < argc)
+            db_path = argv[++i];
+        else if(arg == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if(arg == "--update")
+            update = true;
+        else
+            suite_path = argv[i];
+    }
+    if(!suite_path || golden_path.empty())
+    {
+        std::cout << "Usage: " << argv[0] << " --golden golden.txt [--update] [--images DIR] [--out-dir DIR] [--threads N] [--db nes.db] suite.txt" << std::endl;
+        return 1;
+    }
+    std::ifstream suite_file(suite_path);
+    if(!suite_file)
+    {
+        std::cout << "CAN'T OPEN " << suite_path << std::endl;
+        return 1;
+    }
+    RomDB db;
+    if(!db_path.empty() && !db.load(db_path))
+        std::cout << "CAN'T LOAD DB " << db_path << std::endl;
+    std::map<GoldenKey, unsigned long long> golden;
+    if(!load_golden(golden_path, golden) && !update)
+        std::cout << "CAN'T OPEN " << golden_path << ", EVERY FRAME IS NEW" << std::endl;
+
+    std::vector<GoldenJob> jobs;
+    std::map<std::string, std::shared_ptr<const NESFile>> roms; // Held open so every job shares one image
+    std::string line;
+    int line_number = 0;
+    while(std::getline(suite_file, line))
+    {
+        line_number++;
+        size_t start = line.find_first_not_of(" \t");
+        if(start == std::string::npos || line[start] == '#')
+            continue;
+        GoldenJob job;
+        std::string error;
+        try
+        {
+            if(!parse_golden_job(line, line_number, job, error))
+            {
+                std::cout << suite_path << ":" << line_number << ": " << error << std::endl;
+                return 1;
+            }
+        }
+        catch(const std::exception &)
+        {
+            std::cout << suite_path << ":" << line_number << ": bad number" << std::endl;
+            return 1;
+        }
+        if(!roms.count(job.rom))
+            roms[job.rom] = NESFile::shared(job.rom, &db);
+        jobs.push_back(job);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<GoldenResult> results(jobs.size());
+    {
+        WorkPool pool(threads);
+        threads = pool.size();
+        std::vector<std::unique_ptr<Worker>> workers(threads);
+        for(std::unique_ptr<Worker> &worker : workers)
+            worker.reset(new Worker);
+        for(size_t i = 0; i < jobs.size(); i++)
+        {
+            pool.submit([&, i](int worker)
+            {
+                results[i] = run_golden_job(jobs[i], roms.at(jobs[i].rom), *workers[worker], golden, update, images_dir, out_dir);
+            });
+        }
+        pool.wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int passed = 0, checked = 0, failed_frames = 0;
+    char hash[17], expected[17];
+    for(size_t i = 0; i < jobs.size(); i++)
+    {
+        const GoldenJob &job = jobs[i];
+        const GoldenResult &result = results[i];
+        std::string label = job.rom + (job.movie.empty() ? "" : " (" + job.movie + ")");
+        if(!result.error.empty())
+        {
+            std::cout << "ERROR " << label << ": " << result.error << std::endl;
+            continue;
+        }
+        int failed = 0;
+        for(const FrameResult &frame : result.frames)
+        {
+            checked++;
+            if(update)
+                golden[std::make_tuple(job.rom, job.movie, frame.frame)] = frame.hash;
+            if(frame.outcome != "match" || !frame.images.empty())
+                failed++;
+        }
+        if(!failed)
+        {
+            passed++;
+            std::cout << (update ? "UPDATED " : "PASSED ") << label << " (" << result.frames.size() << " FRAMES, " << result.seconds << "s)" << std::endl;
+            continue;
+        }
+        failed_frames += failed;
+        std::cout << "FAILED " << label << " (" << failed << "/" << result.frames.size() << " FRAMES)" << std::endl;
+        for(const FrameResult &frame : result.frames)
+        {
+            if(frame.outcome == "match" && frame.images.empty())
+                continue;
+            std::snprintf(hash, sizeof(hash), "%016llx", frame.hash);
+            std::snprintf(expected, sizeof(expected), "%016llx", frame.expected);
+            std::cout << "  frame " << frame.frame << " " << frame.outcome << ", hash " << hash;
+            if(frame.outcome == "differs")
+                std::cout << " (expected " << expected << ")";
+            std::cout << ": " << frame.images << std::endl;
+        }
+    }
+    if(update && !save_golden(golden_path, golden))
+    {
+        std::cout << "CAN'T WRITE " << golden_path << std::endl;
+        return 1;
+    }
+    std::cout << passed << "/" << jobs.size() << " ROMS PASSED, " << checked << " FRAMES CHECKED (" << failed_frames << " FAILED) IN "
+        << seconds << "s ON " << threads << " THREADS" << std::endl;
+    return passed == (int)jobs.size() ? 0 : 1;
+}
@@ -0,0 +1,259 @@
+#include<cstring>
+#include<algorithm>
+
+#include "hash.h"
+
+static unsigned int crc_table[256];
+
+static bool make_crc_table()
+{
+    for(unsigned int i = 0; i < 256; i++)
+    {
+        unsigned int c = i;
+        for(int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+    return true;
+}
+
+static bool crc_table_ready = make_crc_table();
+
+// Standard zlib/PNG CRC-32. Pass the previous result as crc to continue a
+// running checksum across several buffers.
+unsigned int crc32(const unsigned char *data, size_t length, unsigned int crc)
+{
+    crc = ~crc;
+    for(size_t i = 0; i < length; i++)
+        crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+#define XXH_PRIME1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME3 0x165667B19E3779F9ULL
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME5 0x27D4EB2F165667C5ULL
+
+static unsigned long long rotl64(unsigned long long x, int n)
+{
+    return (x << n) | (x >> (64 - n));
+}
+
+// Little-endian hosts only, like the save state format
+static unsigned long long read64(const unsigned char *p)
+{
+    unsigned long long v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+static unsigned long long xxh_round(unsigned long long acc, unsigned long long input)
+{
+    acc += input * XXH_PRIME2;
+    return rotl64(acc, 31) * XXH_PRIME1;
+}
+
+static unsigned long long xxh_merge(unsigned long long hash, unsigned long long acc)
+{
+    hash ^= xxh_round(0, acc);
+    return hash * XXH_PRIME1 + XXH_PRIME4;
+}
+
+// XXH64, for fingerprinting machine state. Several GB/s since the four
+// lanes are independent, which is what the per-frame state hashes need.
+unsigned long long xxh64(const void *data, size_t length, unsigned long long seed)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    const unsigned char *end = p + length;
+    unsigned long long hash;
+    if(length >= 32)
+    {
+        unsigned long long v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        unsigned long long v2 = seed + XXH_PRIME2;
+        unsigned long long v3 = seed;
+        unsigned long long v4 = seed - XXH_PRIME1;
+        for(; p + 32 <= end; p += 32)
+        {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+        }
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh_merge(hash, v1);
+        hash = xxh_merge(hash, v2);
+        hash = xxh_merge(hash, v3);
+        hash = xxh_merge(hash, v4);
+    }
+    else
+        hash = seed + XXH_PRIME5;
+    hash += length;
+    for(; p + 8 <= end; p += 8)
+    {
+        hash ^= xxh_round(0, read64(p));
+        hash = rotl64(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if(p + 4 <= end)
+    {
+        unsigned int v;
+        std::memcpy(&v, p, 4);
+        hash ^= v * XXH_PRIME1;
+        hash = rotl64(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for(; p < end; p++)
+    {
+        hash ^= *p * XXH_PRIME5;
+        hash = rotl64(hash, 11) * XXH_PRIME1;
+    }
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+static unsigned int rotl(unsigned int x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+SHA1::SHA1()
+{
+    h[0] = 0x67452301;
+    h[1] = 0xEFCDAB89;
+    h[2] = 0x98BADCFE;
+    h[3] = 0x10325476;
+    h[4] = 0xC3D2E1F0;
+    block_used = 0;
+    total = 0;
+}
+
+void SHA1::process(const unsigned char *chunk)
+{
+    unsigned int w[80];
+    for(int i = 0; i < 16; i++)
+        w[i] = (chunk[i*4] << 24) | (chunk[i*4+1] << 16) | (chunk[i*4+2] << 8) | chunk[i*4+3];
+    for(int i = 16; i < 80; i++)
+        w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    unsigned int a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for(int i = 0; i < 80; i++)
+    {
+        unsigned int f, k;
+        if(i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if(i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if(i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        unsigned int temp = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = temp;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+}
+
+void SHA1::update(const unsigned char *data, size_t length)
+{
+    total += length;
+    if(block_used)
+    {
+        size_t take = std::min(length, 64 - block_used);
+        std::memcpy(block + block_used, data, take);
+        block_used += take;
+        data += take;
+        length -= take;
+        if(block_used < 64)
+            return;
+        process(block);
+        block_used = 0;
+    }
+    while(length >= 64)
+    {
+        process(data);
+        data += 64;
+        length -= 64;
+    }
+    std::memcpy(block, data, length);
+    block_used = length;
+}
+
+void SHA1::finish(unsigned char digest[SHA1_SIZE])
+{
+    unsigned long long bits = total * 8;
+    unsigned char pad = 0x80;
+    update(&pad, 1);
+    unsigned char zero = 0;
+    while(block_used != 56)
+        update(&zero, 1);
+    unsigned char length[8];
+    for(int i = 0; i < 8; i++)
+        length[i] = bits >> (56 - i*8);
+    update(length, 8);
+    for(int i = 0; i < 5; i++)
+    {
+        digest[i*4] = h[i] >> 24;
+        digest[i*4+1] = h[i] >> 16;
+        digest[i*4+2] = h[i] >> 8;
+        digest[i*4+3] = h[i];
+    }
+}
+
+std::string to_hex(const unsigned char *data, size_t length)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out(length * 2, '0');
+    for(size_t i = 0; i < length; i++)
+    {
+        out[i*2] = digits[data[i] >> 4];
+        out[i*2+1] = digits[data[i] & 0xF];
+    }
+    return out;
+}
+
+bool from_hex(const std::string &hex, unsigned char *out, size_t length)
+{
+    if(hex.size() != length * 2)
+        return false;
+    for(size_t i = 0; i < length * 2; i++)
+    {
+        char c = hex[i];
+        int v;
+        if(c >= '0' && c <= '9')
+            v = c - '0';
+        else if(c >= 'a' && c <= 'f')
+            v = c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F')
+            v = c - 'A' + 10;
+        else
+            return false;
+        if(i % 2 == 0)
+            out[i/2] = v << 4;
+        else
+            out[i/2] |= v;
+    }
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include<cstddef>
+#include<string>
+
+unsigned int crc32(const unsigned char *data, size_t length, unsigned int crc = 0);
+unsigned long long xxh64(const void *data, size_t length, unsigned long long seed = 0);
+
+#define SHA1_SIZE 20
+
+class SHA1
+{
+public:
+    SHA1();
+    void update(const unsigned char *data, size_t length);
+    void finish(unsigned char digest[SHA1_SIZE]);
+private:
+    unsigned int h[5];
+    unsigned char block[64];
+    size_t block_used;
+    unsigned long long total;
+    void process(const unsigned char *chunk);
+};
+
+std::string to_hex(const unsigned char *data, size_t length);
+bool from_hex(const std::string &hex, unsigned char *out, size_t length);
+#endif
@@ -0,0 +1,137 @@
+#include<iostream>
+#include<string>
+#include<vector>
+#include<thread>
+#include<atomic>
+#include<chrono>
+#include<algorithm>
+#include<dirent.h>
+#include<sys/stat.h>
+
+#include "nesfile.h"
+#include "romdb.h"
+#include "romindex.h"
+
+// Scans directory trees for iNES images and writes a sorted binary index of
+// their headers and hashes (plus a CSV if asked), so batch runners can pick
+// ROMs without opening them.
+
+static void find_files(const std::string &dir, std::vector<std::string> &files)
+{
+    DIR *handle = opendir(dir.c_str());
+    if(!handle)
+    {
+        std::cout << "CAN'T OPEN DIRECTORY " << dir << std::endl;
+        return;
+    }
+    while(dirent *entry = readdir(handle))
+    {
+        std::string name = entry->d_name;
+        if(name == "." || name == "..")
+            continue;
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if(lstat(path.c_str(), &st) != 0) // Symlinks are skipped so loops can't recurse forever
+            continue;
+        if(S_ISDIR(st.st_mode))
+            find_files(path, files);
+        else if(S_ISREG(st.st_mode) && st.st_size >= INES_HEADER_SIZE)
+            files.push_back(path);
+    }
+    closedir(handle);
+}
+
+struct ScanResult
+{
+    bool valid;
+    RomIndexRecord record;
+};
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> roots;
+    std::string index_path = "roms.idx";
+    std::string csv_path;
+    std::string db_path;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    bool verbose = false;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "-o" && i + 1 < argc)
+            index_path = argv[++i];
+        else if(arg == "--csv" && i + 1 < argc)
+            csv_path = argv[++i];
+        else if(arg == "--db" && i + 1 < argc)
+            db_path = argv[++i];
+        else if(arg == "--threads" && i + 1 < argc)
+            threads = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "-v")
+            verbose = true;
+        else
+            roots.push_back(arg);
+    }
+    if(roots.empty())
+    {
+        std::cout << "Usage: " << argv[0] << " [-o roms.idx] [--csv roms.csv] [--db nes.db] [--threads N] [-v] dir..." << std::endl;
+        return 1;
+    }
+    RomDB db;
+    if(!db_path.empty() && !db.load(db_path))
+        std::cout << "CAN'T LOAD DB " << db_path << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> files;
+    for(const std::string &root : roots)
+        find_files(root, files);
+    std::sort(files.begin(), files.end());
+
+    // Files are handed out one at a time from a shared counter, so a few big
+    // ROMs can't leave the other workers idle
+    std::vector<ScanResult> results(files.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        for(size_t i = next++; i < files.size(); i = next++)
+        {
+            NESFile rom(files[i]);
+            results[i].valid = rom.valid;
+            if(!rom.valid)
+            {
+                if(verbose)
+                    std::cout << "SKIPPING " + files[i] + ": " + rom.error + "\n" << std::flush;
+                continue;
+            }
+            db.apply(rom);
+            results[i].record = make_index_record(rom);
+        }
+    };
+    std::vector<std::thread> pool;
+    threads = std::min<size_t>(threads, std::max<size_t>(files.size(), 1));
+    for(int i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+    for(std::thread &thread : pool)
+        thread.join();
+
+    RomIndex index;
+    for(size_t i = 0; i < files.size(); i++)
+    {
+        if(results[i].valid)
+            index.add(results[i].record, files[i]);
+    }
+    index.sort();
+    if(!index.write(index_path))
+    {
+        std::cout << "CAN'T WRITE INDEX " << index_path << std::endl;
+        return 1;
+    }
+    if(!csv_path.empty() && !index.write_csv(csv_path))
+    {
+        std::cout << "CAN'T WRITE CSV " << csv_path << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "INDEXED " << index.records.size() << " ROMS OF " << files.size() << " FILES IN "
+        << seconds << "s ON " << threads << " THREADS TO " << index_path << std::endl;
+    return 0;
+}
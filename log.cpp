@@ -0,0 +1,209 @@
+#include<iostream>
+#include<thread>
+#include<mutex>
+#include<chrono>
+#include<sstream>
+#include<cstdio>
+
+#include "log.h"
+
+std::atomic<int> log_levels[LOG_CATEGORIES] = {{LOG_INFO}, {LOG_INFO}, {LOG_INFO}, {LOG_INFO}};
+
+static const char *category_names[LOG_CATEGORIES] = {"cpu", "ppu", "mapper", "console"};
+static const char *level_names[LOG_OFF + 1] = {"trace", "debug", "info", "warn", "error", "off"};
+
+// A bounded multi-producer queue: each slot's sequence number says whether
+// it's free for the producer that claimed position pos (sequence == pos) or
+// holds a record for the writer (sequence == pos + 1).
+struct LogSlot
+{
+    std::atomic<size_t> sequence;
+    const LogSite *site;
+    int count;
+    long long args[LOG_MAX_ARGS];
+};
+
+class LogRing
+{
+public:
+    LogRing();
+    ~LogRing();
+    void push(const LogSite &site, int count, const long long *args);
+    void flush();
+private:
+    LogSlot slots[LOG_RING_RECORDS];
+    std::atomic<size_t> enqueue_pos;
+    std::atomic<size_t> dequeue_pos; // Only the writer advances it
+    std::atomic<unsigned long long> dropped;
+    std::atomic<bool> stopping;
+    std::thread writer;
+    bool pop(std::string &line);
+    void write_loop();
+};
+
+LogRing::LogRing() : enqueue_pos(0), dequeue_pos(0), dropped(0), stopping(false)
+{
+    for(size_t i = 0; i < LOG_RING_RECORDS; i++)
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    writer = std::thread(&LogRing::write_loop, this);
+}
+
+LogRing::~LogRing()
+{
+    stopping = true;
+    writer.join();
+}
+
+void LogRing::push(const LogSite &site, int count, const long long *args)
+{
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    while(true)
+    {
+        slot = &slots[pos & (LOG_RING_RECORDS - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if(sequence == pos)
+        {
+            if(enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if(sequence < pos) // The writer hasn't freed this slot yet, the ring is full
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+    slot->site = &site;
+    slot->count = count;
+    for(int i = 0; i < count; i++)
+        slot->args[i] = args[i];
+    slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+static void format_record(const LogSlot &slot, std::string &line)
+{
+    const LogSite &site = *slot.site;
+    line = category_names[site.category];
+    line += ' ';
+    line += level_names[site.level];
+    line += ": ";
+    int arg = 0;
+    char number[24];
+    for(const char *c = site.format; *c; c++)
+    {
+        bool hex = c[0] == '{' && c[1] == 'x' && c[2] == '}';
+        if(arg < slot.count && (hex || (c[0] == '{' && c[1] == '}')))
+        {
+            std::snprintf(number, sizeof(number), hex ? "0x%llx" : "%lld", slot.args[arg++]);
+            line += number;
+            c += hex ? 2 : 1;
+        }
+        else
+            line += *c;
+    }
+}
+
+bool LogRing::pop(std::string &line)
+{
+    size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+    LogSlot &slot = slots[pos & (LOG_RING_RECORDS - 1)];
+    if(slot.sequence.load(std::memory_order_acquire) != pos + 1)
+        return false;
+    format_record(slot, line);
+    slot.sequence.store(pos + LOG_RING_RECORDS, std::memory_order_release);
+    dequeue_pos.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+void LogRing::write_loop()
+{
+    std::string line;
+    unsigned long long reported_drops = 0;
+    while(true)
+    {
+        bool stop = stopping.load();
+        bool wrote = false;
+        while(pop(line))
+        {
+            std::cout << line << '\n';
+            wrote = true;
+        }
+        unsigned long long drops = dropped.load(std::memory_order_relaxed);
+        if(drops != reported_drops)
+        {
+            std::cout << "LOG DROPPED " << drops - reported_drops << " MESSAGES" << '\n';
+            reported_drops = drops;
+            wrote = true;
+        }
+        if(wrote)
+            std::cout.flush();
+        if(stop)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+void LogRing::flush()
+{
+    size_t target = enqueue_pos.load();
+    while(dequeue_pos.load(std::memory_order_acquire) < target)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// Started by the first message, so programs that never log never get the thread
+static LogRing &ring()
+{
+    static LogRing instance;
+    return instance;
+}
+
+void log_record(const LogSite &site, int count, const long long *args)
+{
+    ring().push(site, count, args);
+}
+
+void log_flush()
+{
+    ring().flush();
+}
+
+bool log_configure(const std::string &spec)
+{
+    int levels[LOG_CATEGORIES];
+    for(int i = 0; i < LOG_CATEGORIES; i++)
+        levels[i] = log_levels[i];
+    std::stringstream items(spec);
+    std::string item;
+    while(std::getline(items, item, ','))
+    {
+        size_t equals = item.find('=');
+        if(equals == std::string::npos)
+            return false;
+        std::string category = item.substr(0, equals);
+        std::string level_name = item.substr(equals + 1);
+        int level = -1;
+        for(int i = 0; i <= LOG_OFF; i++)
+        {
+            if(level_name == level_names[i])
+                level = i;
+        }
+        if(level < 0)
+            return false;
+        bool found = false;
+        for(int i = 0; i < LOG_CATEGORIES; i++)
+        {
+            if(category == "all" || category == category_names[i])
+            {
+                levels[i] = level;
+                found = true;
+            }
+        }
+        if(!found)
+            return false;
+    }
+    for(int i = 0; i < LOG_CATEGORIES; i++)
+        log_levels[i] = levels[i];
+    return true;
+}
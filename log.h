@@ -0,0 +1,71 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include<atomic>
+#include<string>
+#include<type_traits>
+
+// Levels, lowest first
+#define LOG_TRACE 0
+#define LOG_DEBUG 1
+#define LOG_INFO 2
+#define LOG_WARN 3
+#define LOG_ERROR 4
+#define LOG_OFF 5
+
+// Messages below this level compile to nothing; build with e.g.
+// make LOG_LEVEL=0 to keep every trace message available at run time
+#ifndef NES_LOG_LEVEL
+#define NES_LOG_LEVEL LOG_INFO
+#endif
+
+#define LOG_CPU 0
+#define LOG_PPU 1
+#define LOG_MAPPER 2
+#define LOG_CONSOLE 3
+#define LOG_CATEGORIES 4
+
+#define LOG_MAX_ARGS 4
+#define LOG_RING_RECORDS 4096 // Power of two; records logged while it's full are dropped
+
+// One per NES_LOG call site. The ring records a pointer to it plus the raw
+// arguments, and the writer thread formats the message later.
+struct LogSite
+{
+    int category;
+    int level;
+    const char *format; // {} prints an argument in decimal, {x} in hex
+};
+
+extern std::atomic<int> log_levels[LOG_CATEGORIES]; // Run-time threshold per category
+
+inline bool log_enabled(int category, int level)
+{
+    return level >= log_levels[category].load(std::memory_order_relaxed);
+}
+
+void log_record(const LogSite &site, int count, const long long *args);
+
+template<class... Args> void log_write(const LogSite &site, Args... args)
+{
+    static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+    static_assert(std::is_integral<typename std::common_type<int, Args...>::type>::value, "log arguments must be integers");
+    const long long values[] = {0, static_cast<long long>(args)...};
+    log_record(site, sizeof...(Args), values + 1);
+}
+
+#define NES_LOG(category, level, format, ...) \
+    do \
+    { \
+        if((level) >= NES_LOG_LEVEL && log_enabled(category, level)) \
+        { \
+            static const LogSite log_site = {category, level, format}; \
+            log_write(log_site, ##__VA_ARGS__); \
+        } \
+    } while(0)
+
+// Sets run-time levels from a spec like "ppu=debug,cpu=trace" or "all=warn".
+// Returns false (leaving the levels as they were) if the spec is malformed.
+bool log_configure(const std::string &spec);
+void log_flush(); // Waits until everything logged so far has been written
+#endif
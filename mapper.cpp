@@ -0,0 +1,448 @@
+#include "mapper.h"
+
+static_assert(sizeof(MMC1State) <= MAPPER_STATE_SIZE, "MMC1State doesn't fit in a SaveState");
+static_assert(sizeof(BankState) <= MAPPER_STATE_SIZE, "BankState doesn't fit in a SaveState");
+static_assert(sizeof(MMC3State) <= MAPPER_STATE_SIZE, "MMC3State doesn't fit in a SaveState");
+
+Mapper::Mapper(CPU *cpu, PPU *ppu, const NESFile &rom)
+    : cpu(cpu), ppu(ppu), prg(rom.prg_rom), prg_size(rom.prg_rom_size)
+{
+    chr_is_ram = rom.chr_rom == nullptr;
+    if(chr_is_ram)
+    {
+        chr_ram_storage.resize(MAPPER_CHR_RAM_SIZE);
+        chr = chr_ram_storage.data();
+        chr_size = chr_ram_storage.size();
+    }
+    else
+    {
+        // The PPU only writes through chr_pages when it has chr_ram set,
+        // so ROM in a read-only mapping is safe to point at
+        chr = const_cast<unsigned char *>(rom.chr_rom);
+        chr_size = rom.chr_rom_size;
+    }
+    prg_ram_data = nullptr;
+    if(rom.prg_ram_size + rom.prg_nvram_size > 0)
+    {
+        prg_ram_storage.resize(MAPPER_PRG_RAM_SIZE);
+        prg_ram_data = prg_ram_storage.data();
+    }
+    cpu->prg_ram_page = prg_ram_data;
+    cpu->mapper = this;
+    ppu->mapper = this;
+    ppu->a12_watch = false;
+    ppu->chr_ram = chr_is_ram ? chr : nullptr;
+    ppu->mark_chr_dirty();
+    four_screen = rom.four_screen;
+    if(four_screen)
+        vram_storage.resize(MAPPER_VRAM_SIZE);
+    ppu->cart_vram = four_screen ? vram_storage.data() : nullptr;
+    ppu->set_mirroring(four_screen ? MIRROR_FOUR_SCREEN : rom.mirroring);
+}
+
+Mapper::~Mapper()
+{
+    if(cpu->mapper == this)
+    {
+        cpu->mapper = nullptr;
+        cpu->prg_ram_page = nullptr;
+    }
+    if(ppu->mapper == this)
+    {
+        ppu->mapper = nullptr;
+        ppu->a12_watch = false;
+        ppu->chr_ram = nullptr;
+        ppu->cart_vram = nullptr;
+        ppu->map_nametables();
+    }
+}
+
+void Mapper::write_register(unsigned short address, unsigned char value)
+{
+}
+
+void Mapper::ppu_a12_rise()
+{
+}
+
+void *Mapper::state_data()
+{
+    return nullptr;
+}
+
+size_t Mapper::state_size()
+{
+    return 0;
+}
+
+void Mapper::set_mirroring(unsigned char mode)
+{
+    if(!four_screen)
+        ppu->set_mirroring(mode);
+}
+
+unsigned char *Mapper::chr_ram()
+{
+    return chr_is_ram ? chr : nullptr;
+}
+
+unsigned char *Mapper::vram()
+{
+    return four_screen ? vram_storage.data() : nullptr;
+}
+
+unsigned char *Mapper::prg_ram()
+{
+    return prg_ram_data;
+}
+
+void Mapper::set_prg_ram(unsigned char *ram)
+{
+    prg_ram_data = ram;
+    prg_ram_storage.clear();
+    prg_ram_storage.shrink_to_fit();
+    cpu->prg_ram_page = prg_ram_data;
+}
+
+int Mapper::prg_banks_8k()
+{
+    return std::max<int>(prg_size / 0x2000, 1);
+}
+
+int Mapper::chr_banks_1k()
+{
+    return std::max<int>(chr_size / 0x400, 1);
+}
+
+void Mapper::map_prg_8k(int slot, int bank)
+{
+    bank %= prg_banks_8k();
+    cpu->prg_pages[slot] = &prg[bank * 0x2000];
+}
+
+void Mapper::map_prg_16k(int slot, int bank)
+{
+    map_prg_8k(slot*2, bank*2);
+    map_prg_8k(slot*2 + 1, bank*2 + 1);
+}
+
+void Mapper::map_prg_32k(int bank)
+{
+    map_prg_16k(0, bank*2);
+    map_prg_16k(1, bank*2 + 1);
+}
+
+void Mapper::map_chr_1k(int slot, int bank)
+{
+    bank %= chr_banks_1k();
+    ppu->chr_pages[slot] = &chr[bank * 0x400];
+}
+
+void Mapper::map_chr_4k(int slot, int bank)
+{
+    for(int i = 0; i < 4; i++)
+        map_chr_1k(slot*4 + i, bank*4 + i);
+}
+
+void Mapper::map_chr_8k(int bank)
+{
+    map_chr_4k(0, bank*2);
+    map_chr_4k(1, bank*2 + 1);
+}
+
+void NROM::update_banks()
+{
+    map_prg_16k(0, 0);
+    map_prg_16k(1, prg_banks_8k()/2 - 1); // NROM-128 mirrors its one bank
+    map_chr_8k(0);
+}
+
+MMC1::MMC1(CPU *cpu, PPU *ppu, const NESFile &rom)
+    : Mapper(cpu, ppu, rom)
+{
+    state = MMC1State();
+    state.control = 0x0C; // PRG mode 3 at power on: last bank fixed at $C000
+}
+
+// Registers are loaded serially, one bit per write, and committed on the
+// fifth write to whichever register the last address selects.
+void MMC1::write_register(unsigned short address, unsigned char value)
+{
+    if(value & 0x80)
+    {
+        state.shift = 0;
+        state.shift_count = 0;
+        state.control |= 0x0C;
+        update_banks();
+        return;
+    }
+    state.shift |= (value & 0x1) << state.shift_count;
+    state.shift_count++;
+    if(state.shift_count < 5)
+        return;
+    switch((address >> 13) & 0x3)
+    {
+        case 0:
+            state.control = state.shift;
+            break;
+        case 1:
+            state.chr_bank[0] = state.shift;
+            break;
+        case 2:
+            state.chr_bank[1] = state.shift;
+            break;
+        case 3:
+            state.prg_bank = state.shift & 0xF;
+            break;
+    }
+    state.shift = 0;
+    state.shift_count = 0;
+    update_banks();
+}
+
+void MMC1::update_banks()
+{
+    switch(state.control & 0x3)
+    {
+        case 0:
+            set_mirroring(MIRROR_SINGLE_LOWER);
+            break;
+        case 1:
+            set_mirroring(MIRROR_SINGLE_UPPER);
+            break;
+        case 2:
+            set_mirroring(MIRROR_VERTICAL);
+            break;
+        case 3:
+            set_mirroring(MIRROR_HORIZONTAL);
+            break;
+    }
+    switch((state.control >> 2) & 0x3)
+    {
+        case 0:
+        case 1: // 32kb at $8000, low bit ignored
+            map_prg_32k(state.prg_bank >> 1);
+            break;
+        case 2: // First bank fixed at $8000
+            map_prg_16k(0, 0);
+            map_prg_16k(1, state.prg_bank);
+            break;
+        case 3: // Last bank fixed at $C000
+            map_prg_16k(0, state.prg_bank);
+            map_prg_16k(1, prg_banks_8k()/2 - 1);
+            break;
+    }
+    if(state.control & 0x10) // Two 4kb banks
+    {
+        map_chr_4k(0, state.chr_bank[0]);
+        map_chr_4k(1, state.chr_bank[1]);
+    }
+    else
+        map_chr_8k(state.chr_bank[0] >> 1);
+}
+
+void *MMC1::state_data()
+{
+    return &state;
+}
+
+size_t MMC1::state_size()
+{
+    return sizeof(state);
+}
+
+void UxROM::write_register(unsigned short address, unsigned char value)
+{
+    state.bank = value;
+    update_banks();
+}
+
+void UxROM::update_banks()
+{
+    map_prg_16k(0, state.bank);
+    map_prg_16k(1, prg_banks_8k()/2 - 1);
+    map_chr_8k(0);
+}
+
+void *UxROM::state_data()
+{
+    return &state;
+}
+
+size_t UxROM::state_size()
+{
+    return sizeof(state);
+}
+
+void CNROM::write_register(unsigned short address, unsigned char value)
+{
+    state.bank = value & 0x3;
+    update_banks();
+}
+
+void CNROM::update_banks()
+{
+    map_prg_16k(0, 0);
+    map_prg_16k(1, prg_banks_8k()/2 - 1);
+    map_chr_8k(state.bank);
+}
+
+void *CNROM::state_data()
+{
+    return &state;
+}
+
+size_t CNROM::state_size()
+{
+    return sizeof(state);
+}
+
+void AxROM::write_register(unsigned short address, unsigned char value)
+{
+    state.bank = value;
+    update_banks();
+}
+
+void AxROM::update_banks()
+{
+    map_prg_32k(state.bank & 0x7);
+    map_chr_8k(0);
+    set_mirroring((state.bank & 0x10) ? MIRROR_SINGLE_UPPER : MIRROR_SINGLE_LOWER);
+}
+
+void *AxROM::state_data()
+{
+    return &state;
+}
+
+size_t AxROM::state_size()
+{
+    return sizeof(state);
+}
+
+MMC3::MMC3(CPU *cpu, PPU *ppu, const NESFile &rom)
+    : Mapper(cpu, ppu, rom)
+{
+    state = MMC3State();
+    state.mirroring = rom.mirroring == MIRROR_HORIZONTAL;
+    ppu->a12_watch = true;
+}
+
+void MMC3::write_register(unsigned short address, unsigned char value)
+{
+    bool odd = address & 0x1;
+    switch(address & 0xE000)
+    {
+        case 0x8000:
+            if(odd)
+                state.banks[state.bank_select & 0x7] = value;
+            else
+                state.bank_select = value;
+            update_banks();
+            break;
+        case 0xA000:
+            if(odd)
+                state.prg_ram_protect = value;
+            else
+            {
+                state.mirroring = value & 0x1;
+                update_banks();
+            }
+            break;
+        case 0xC000:
+            if(odd)
+            {
+                state.irq_counter = 0;
+                state.irq_reload = true;
+            }
+            else
+                state.irq_latch = value;
+            break;
+        case 0xE000:
+            state.irq_enabled = odd;
+            if(!odd)
+                cpu->IRQ = false; // Disabling also acknowledges
+            break;
+    }
+}
+
+void MMC3::update_banks()
+{
+    set_mirroring(state.mirroring ? MIRROR_HORIZONTAL : MIRROR_VERTICAL);
+    int second_last = prg_banks_8k() - 2;
+    if(state.bank_select & 0x40)
+    {
+        map_prg_8k(0, second_last);
+        map_prg_8k(2, state.banks[6]);
+    }
+    else
+    {
+        map_prg_8k(0, state.banks[6]);
+        map_prg_8k(2, second_last);
+    }
+    map_prg_8k(1, state.banks[7]);
+    map_prg_8k(3, prg_banks_8k() - 1);
+
+    // R0/R1 are 2kb banks, R2-R5 1kb; CHR inversion swaps the two halves
+    int invert = (state.bank_select & 0x80) ? 4 : 0;
+    map_chr_1k(0 ^ invert, state.banks[0] & 0xFE);
+    map_chr_1k(1 ^ invert, state.banks[0] | 0x01);
+    map_chr_1k(2 ^ invert, state.banks[1] & 0xFE);
+    map_chr_1k(3 ^ invert, state.banks[1] | 0x01);
+    for(int i = 0; i < 4; i++)
+        map_chr_1k((4 + i) ^ invert, state.banks[2 + i]);
+}
+
+// Clocked once per scanline while rendering; see PPU::do_cycle
+void MMC3::ppu_a12_rise()
+{
+    if(state.irq_counter == 0 || state.irq_reload)
+    {
+        state.irq_counter = state.irq_latch;
+        state.irq_reload = false;
+    }
+    else
+        state.irq_counter--;
+    if(state.irq_counter == 0 && state.irq_enabled)
+        cpu->IRQ = true;
+}
+
+void *MMC3::state_data()
+{
+    return &state;
+}
+
+size_t MMC3::state_size()
+{
+    return sizeof(state);
+}
+
+Mapper *create_mapper(CPU *cpu, PPU *ppu, const NESFile &rom)
+{
+    Mapper *mapper;
+    switch(rom.mapper)
+    {
+        case 0:
+            mapper = new NROM(cpu, ppu, rom);
+            break;
+        case 1:
+            mapper = new MMC1(cpu, ppu, rom);
+            break;
+        case 2:
+            mapper = new UxROM(cpu, ppu, rom);
+            break;
+        case 3:
+            mapper = new CNROM(cpu, ppu, rom);
+            break;
+        case 4:
+            mapper = new MMC3(cpu, ppu, rom);
+            break;
+        case 7:
+            mapper = new AxROM(cpu, ppu, rom);
+            break;
+        default:
+            return nullptr;
+    }
+    mapper->update_banks();
+    return mapper;
+}
@@ -0,0 +1,163 @@
+#ifndef MAPPER_H
+#define MAPPER_H
+
+#include<vector>
+#include<cstddef>
+
+#include "cpu.h"
+#include "ppu.h"
+#include "nesfile.h"
+
+#define MAPPER_STATE_SIZE 64 // Room in a SaveState for any mapper's registers
+#define MAPPER_CHR_RAM_SIZE 0x2000
+#define MAPPER_PRG_RAM_SIZE 0x2000 // $6000-$7FFF, no implemented board banks it
+#define MAPPER_VRAM_SIZE 0x800 // Four-screen boards add this much nametable RAM
+
+// A cartridge board. Implements bank switching by pointing the CPU's 8kb PRG
+// pages and the PPU's 1kb CHR pages into the ROM image (or the board's own
+// CHR RAM), so a bank switch never copies any bytes.
+//
+// Each mapper keeps its registers in a plain struct exposed through
+// state_data() so save states can copy it as a block; update_banks() then
+// rebuilds the page pointers from the registers.
+class Mapper
+{
+public:
+    Mapper(CPU *cpu, PPU *ppu, const NESFile &rom);
+    virtual ~Mapper();
+    virtual void write_register(unsigned short address, unsigned char value);
+    virtual void update_banks() = 0;
+    virtual void ppu_a12_rise(); // Only called when the mapper sets ppu->a12_watch
+    virtual void *state_data();
+    virtual size_t state_size();
+    unsigned char *chr_ram(); // nullptr for CHR ROM boards
+    unsigned char *prg_ram(); // nullptr for boards without PRG RAM
+    unsigned char *vram(); // nullptr unless the board is four-screen
+    void set_prg_ram(unsigned char *ram); // Replace the board's own PRG RAM, e.g. with a battery file
+protected:
+    CPU *cpu;
+    PPU *ppu;
+    const unsigned char *prg;
+    size_t prg_size;
+    unsigned char *chr;
+    size_t chr_size;
+    std::vector<unsigned char> chr_ram_storage;
+    bool chr_is_ram;
+    unsigned char *prg_ram_data;
+    std::vector<unsigned char> prg_ram_storage;
+    bool four_screen; // Extra nametable RAM on the board overrides the mirroring register
+    std::vector<unsigned char> vram_storage;
+    void set_mirroring(unsigned char mode);
+    void map_prg_8k(int slot, int bank);
+    void map_prg_16k(int slot, int bank);
+    void map_prg_32k(int bank);
+    void map_chr_1k(int slot, int bank);
+    void map_chr_4k(int slot, int bank);
+    void map_chr_8k(int bank);
+    int prg_banks_8k();
+    int chr_banks_1k();
+};
+
+// Mapper 0
+class NROM : public Mapper
+{
+public:
+    using Mapper::Mapper;
+    void update_banks();
+};
+
+struct MMC1State
+{
+    unsigned char shift;
+    unsigned char shift_count;
+    unsigned char control;
+    unsigned char chr_bank[2];
+    unsigned char prg_bank;
+};
+
+// Mapper 1
+class MMC1 : public Mapper
+{
+public:
+    MMC1(CPU *cpu, PPU *ppu, const NESFile &rom);
+    void write_register(unsigned short address, unsigned char value);
+    void update_banks();
+    void *state_data();
+    size_t state_size();
+private:
+    MMC1State state;
+};
+
+struct BankState
+{
+    unsigned char bank;
+};
+
+// Mapper 2
+class UxROM : public Mapper
+{
+public:
+    using Mapper::Mapper;
+    void write_register(unsigned short address, unsigned char value);
+    void update_banks();
+    void *state_data();
+    size_t state_size();
+private:
+    BankState state = {};
+};
+
+// Mapper 3
+class CNROM : public Mapper
+{
+public:
+    using Mapper::Mapper;
+    void write_register(unsigned short address, unsigned char value);
+    void update_banks();
+    void *state_data();
+    size_t state_size();
+private:
+    BankState state = {};
+};
+
+// Mapper 7
+class AxROM : public Mapper
+{
+public:
+    using Mapper::Mapper;
+    void write_register(unsigned short address, unsigned char value);
+    void update_banks();
+    void *state_data();
+    size_t state_size();
+private:
+    BankState state = {};
+};
+
+struct MMC3State
+{
+    unsigned char bank_select;
+    unsigned char banks[8];
+    unsigned char mirroring;
+    unsigned char prg_ram_protect;
+    unsigned char irq_latch;
+    unsigned char irq_counter;
+    bool irq_reload;
+    bool irq_enabled;
+};
+
+// Mapper 4
+class MMC3 : public Mapper
+{
+public:
+    MMC3(CPU *cpu, PPU *ppu, const NESFile &rom);
+    void write_register(unsigned short address, unsigned char value);
+    void update_banks();
+    void ppu_a12_rise();
+    void *state_data();
+    size_t state_size();
+private:
+    MMC3State state;
+};
+
+// Returns nullptr when rom.mapper isn't implemented
+Mapper *create_mapper(CPU *cpu, PPU *ppu, const NESFile &rom);
+#endif
@@ -0,0 +1,329 @@
+#include<iostream>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<chrono>
+#include<algorithm>
+#include<cstdio>
+
+#include "cpu.h"
+#include "ppu.h"
+
+// Per-opcode CPU microbenchmarks. Each case is a loop of COPIES copies of one
+// instruction (or a balanced pair, like PHA/PLA) followed by a JMP back,
+// placed straight into the CPU's PRG pages. The PPU is never stepped and
+// there's no mapper, so only CPU::do_cycle is measured. Indexed reads also run
+// with operands that cross a page, to time the extra-cycle paths. The JMP
+// back's cycles, and its time from a loop of nothing but the JMP, are taken
+// out before dividing, so the columns are for the instruction alone.
+
+#define COPIES 64
+#define PRG_SIZE 0x8000
+#define JMP_CYCLES 3
+
+enum Mode { IMP, ACC, IMM, ZP, ZPX, ZPY, ABS, ABSX, ABSY, INDX, INDY, REL, IND, PAIR };
+
+struct Opcode
+{
+    int opcode;
+    const char *name;
+    Mode mode;
+};
+
+static const Opcode opcodes[] =
+{
+    {0x69, "ADC", IMM}, {0x65, "ADC", ZP}, {0x75, "ADC", ZPX}, {0x6D, "ADC", ABS}, {0x7D, "ADC", ABSX}, {0x79, "ADC", ABSY}, {0x61, "ADC", INDX}, {0x71, "ADC", INDY},
+    {0x29, "AND", IMM}, {0x25, "AND", ZP}, {0x35, "AND", ZPX}, {0x2D, "AND", ABS}, {0x3D, "AND", ABSX}, {0x39, "AND", ABSY}, {0x21, "AND", INDX}, {0x31, "AND", INDY},
+    {0x0A, "ASL", ACC}, {0x06, "ASL", ZP}, {0x16, "ASL", ZPX}, {0x0E, "ASL", ABS}, {0x1E, "ASL", ABSX},
+    {0x90, "BCC", REL}, {0xB0, "BCS", REL}, {0xF0, "BEQ", REL}, {0x30, "BMI", REL}, {0xD0, "BNE", REL}, {0x10, "BPL", REL}, {0x50, "BVC", REL}, {0x70, "BVS", REL},
+    {0x24, "BIT", ZP}, {0x2C, "BIT", ABS},
+    {0x18, "CLC", IMP}, {0xD8, "CLD", IMP}, {0x58, "CLI", IMP}, {0xB8, "CLV", IMP},
+    {0xC9, "CMP", IMM}, {0xC5, "CMP", ZP}, {0xD5, "CMP", ZPX}, {0xCD, "CMP", ABS}, {0xDD, "CMP", ABSX}, {0xD9, "CMP", ABSY}, {0xC1, "CMP", INDX}, {0xD1, "CMP", INDY},
+    {0xE0, "CPX", IMM}, {0xE4, "CPX", ZP}, {0xEC, "CPX", ABS}, {0xC0, "CPY", IMM}, {0xC4, "CPY", ZP}, {0xCC, "CPY", ABS},
+    {0xC6, "DEC", ZP}, {0xD6, "DEC", ZPX}, {0xCE, "DEC", ABS}, {0xDE, "DEC", ABSX}, {0xCA, "DEX", IMP}, {0x88, "DEY", IMP},
+    {0x49, "EOR", IMM}, {0x45, "EOR", ZP}, {0x55, "EOR", ZPX}, {0x4D, "EOR", ABS}, {0x5D, "EOR", ABSX}, {0x59, "EOR", ABSY}, {0x41, "EOR", INDX}, {0x51, "EOR", INDY},
+    {0xE6, "INC", ZP}, {0xF6, "INC", ZPX}, {0xEE, "INC", ABS}, {0xFE, "INC", ABSX}, {0xE8, "INX", IMP}, {0xC8, "INY", IMP},
+    {0x4C, "JMP", ABS}, {0x6C, "JMP", IND},
+    {0xA9, "LDA", IMM}, {0xA5, "LDA", ZP}, {0xB5, "LDA", ZPX}, {0xAD, "LDA", ABS}, {0xBD, "LDA", ABSX}, {0xB9, "LDA", ABSY}, {0xA1, "LDA", INDX}, {0xB1, "LDA", INDY},
+    {0xA2, "LDX", IMM}, {0xA6, "LDX", ZP}, {0xB6, "LDX", ZPY}, {0xAE, "LDX", ABS}, {0xBE, "LDX", ABSY},
+    {0xA0, "LDY", IMM}, {0xA4, "LDY", ZP}, {0xB4, "LDY", ZPX}, {0xAC, "LDY", ABS}, {0xBC, "LDY", ABSX},
+    {0x4A, "LSR", ACC}, {0x46, "LSR", ZP}, {0x56, "LSR", ZPX}, {0x4E, "LSR", ABS}, {0x5E, "LSR", ABSX},
+    {0xEA, "NOP", IMP},
+    {0x09, "ORA", IMM}, {0x05, "ORA", ZP}, {0x15, "ORA", ZPX}, {0x0D, "ORA", ABS}, {0x1D, "ORA", ABSX}, {0x19, "ORA", ABSY}, {0x01, "ORA", INDX}, {0x11, "ORA", INDY},
+    {0x48, "PHA+PLA", PAIR}, {0x08, "PHP+PLP", PAIR}, {0x20, "JSR+RTS", PAIR}, {0x00, "BRK+RTI", PAIR},
+    {0x2A, "ROL", ACC}, {0x26, "ROL", ZP}, {0x36, "ROL", ZPX}, {0x2E, "ROL", ABS}, {0x3E, "ROL", ABSX},
+    {0x6A, "ROR", ACC}, {0x66, "ROR", ZP}, {0x76, "ROR", ZPX}, {0x6E, "ROR", ABS}, {0x7E, "ROR", ABSX},
+    {0xE9, "SBC", IMM}, {0xE5, "SBC", ZP}, {0xF5, "SBC", ZPX}, {0xED, "SBC", ABS}, {0xFD, "SBC", ABSX}, {0xF9, "SBC", ABSY}, {0xE1, "SBC", INDX}, {0xF1, "SBC", INDY},
+    {0x38, "SEC", IMP}, {0xF8, "SED", IMP}, {0x78, "SEI", IMP},
+    {0x85, "STA", ZP}, {0x95, "STA", ZPX}, {0x8D, "STA", ABS}, {0x9D, "STA", ABSX}, {0x99, "STA", ABSY}, {0x81, "STA", INDX}, {0x91, "STA", INDY},
+    {0x86, "STX", ZP}, {0x96, "STX", ZPY}, {0x8E, "STX", ABS}, {0x84, "STY", ZP}, {0x94, "STY", ZPX}, {0x8C, "STY", ABS},
+    {0xAA, "TAX", IMP}, {0xA8, "TAY", IMP}, {0xBA, "TSX", IMP}, {0x8A, "TXA", IMP}, {0x9A, "TXS", IMP}, {0x98, "TYA", IMP},
+};
+
+static const char *mode_names[] = {"", "A", "#imm", "zp", "zp,X", "zp,Y", "abs", "abs,X", "abs,Y", "(zp,X)", "(zp),Y", "rel", "(abs)", ""};
+
+struct Case
+{
+    std::string name;
+    int opcode;
+    std::vector<unsigned char> prg;
+    int instructions; // Per loop iteration, not counting the JMP back
+    bool taken; // Branches: whether the condition holds
+};
+
+struct CaseResult
+{
+    std::string name;
+    int opcode;
+    double cycles_per_instruction;
+    double ns_per_instruction;
+    double ns_per_cycle;
+};
+
+// X and Y are 1 when a case starts; operands are chosen so indexing stays in
+// RAM, and the _cross variants add the index across a page boundary
+static std::vector<unsigned char> operand(Mode mode, bool cross)
+{
+    switch(mode)
+    {
+        case IMM: return {0x01};
+        case ZP: return {0x30};
+        case ZPX: case ZPY: return {0x30};
+        case ABS: return {0x00, 0x03};
+        case ABSX: case ABSY: return cross ? std::vector<unsigned char>{0xFF, 0x03} : std::vector<unsigned char>{0x00, 0x03};
+        case INDX: return {0x10}; // Pointer at $11
+        case INDY: return {(unsigned char)(cross ? 0x22 : 0x20)};
+        case REL: return {0x00}; // Taken or not, lands on the next instruction
+        default: return {};
+    }
+}
+
+static void put(std::vector<unsigned char> &prg, size_t &at, std::initializer_list<int> bytes)
+{
+    for(int byte : bytes)
+        prg[at++] = byte;
+}
+
+static Case make_case(const Opcode &op, bool cross, bool taken)
+{
+    Case c;
+    c.opcode = op.opcode;
+    c.taken = taken;
+    c.name = op.name;
+    if(mode_names[op.mode][0])
+        c.name += std::string(" ") + mode_names[op.mode];
+    if(cross)
+        c.name += " cross";
+    if(op.mode == REL)
+        c.name += taken ? " taken" : " not taken";
+    c.prg.assign(PRG_SIZE, 0xEA);
+    size_t at = 0;
+    int per_copy = 1;
+    std::vector<unsigned char> bytes = operand(op.mode, cross);
+    for(int i = 0; i < COPIES; i++)
+    {
+        unsigned short next;
+        switch(op.mode)
+        {
+            case PAIR:
+                per_copy = 2;
+                if(op.opcode == 0x48 || op.opcode == 0x08)
+                    put(c.prg, at, {op.opcode, op.opcode + 0x20}); // PHA PLA, PHP PLP
+                else if(op.opcode == 0x20)
+                    put(c.prg, at, {0x20, 0x00, 0xF0}); // JSR $F000, an RTS
+                else
+                    put(c.prg, at, {0x00, 0xEA}); // BRK returns past its padding byte via RTI
+                break;
+            case IND:
+                put(c.prg, at, {0x6C, (0x00 + i*2) & 0xFF, 0x04 + (i*2 >> 8)}); // Pointers at $0400, set up by run_case
+                break;
+            default:
+                if(op.opcode == 0x4C)
+                {
+                    next = 0x8000 + at + 3;
+                    put(c.prg, at, {0x4C, next & 0xFF, next >> 8});
+                    break;
+                }
+                c.prg[at++] = op.opcode;
+                for(unsigned char byte : bytes)
+                    c.prg[at++] = byte;
+        }
+    }
+    put(c.prg, at, {0x4C, 0x00, 0x80});
+    c.prg[0x7000] = 0x60; // $F000: RTS
+    c.prg[0x7001] = 0x40; // $F001: RTI
+    c.prg[0x7FFE] = 0x01; // BRK/IRQ vector, $F001
+    c.prg[0x7FFF] = 0xF0;
+    c.instructions = COPIES * per_copy;
+    return c;
+}
+
+// Sets the flags so a branch opcode's condition is (or isn't) met
+static void set_branch_flags(CPU &cpu, int opcode, bool taken)
+{
+    bool flag_set = (opcode & 0x20) != 0; // BCS/BEQ/BMI/BVS branch when their flag is set
+    bool value = taken ? flag_set : !flag_set;
+    switch(opcode >> 6)
+    {
+        case 0: cpu.flags_negative = value; break;
+        case 1: cpu.flags_overflow = value; break;
+        case 2: cpu.flags_carry = value; break;
+        case 3: cpu.flags_zero = value; break;
+    }
+}
+
+static void reset_cpu(CPU &cpu, PPU &ppu, const Case &c)
+{
+    CPUState &state = cpu;
+    state = CPU();
+    cpu.ppu = &ppu;
+    for(int i = 0; i < 4; i++)
+        cpu.prg_pages[i] = &c.prg[i * 0x2000];
+    cpu.PC = 0x8000;
+    cpu.X = 1;
+    cpu.Y = 1;
+    cpu.flags_int_disable = 0;
+    cpu.ram[0x11] = 0x00; // ($10,X) -> $0300
+    cpu.ram[0x12] = 0x03;
+    cpu.ram[0x20] = 0x00; // ($20),Y -> $0301
+    cpu.ram[0x21] = 0x03;
+    cpu.ram[0x22] = 0xFF; // ($22),Y -> $0400, crossing
+    cpu.ram[0x23] = 0x03;
+    for(int i = 0; i < COPIES; i++) // JMP (ind) pointers, each to the next copy
+    {
+        unsigned short next = 0x8000 + (i + 1) * 3;
+        cpu.ram[0x400 + i*2] = next & 0xFF;
+        cpu.ram[0x401 + i*2] = next >> 8;
+    }
+    if((c.opcode & 0x1F) == 0x10)
+        set_branch_flags(cpu, c.opcode, c.taken);
+}
+
+// Median time of running the CPU for cycles, over reps runs
+static double time_cycles(CPU &cpu, long long cycles, int reps)
+{
+    std::vector<double> ns;
+    for(int rep = 0; rep < reps; rep++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for(long long i = 0; i < cycles; i++)
+            cpu.do_cycle();
+        ns.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(ns.begin(), ns.end());
+    return ns[ns.size() / 2];
+}
+
+// Time of one JMP back, from a loop that's nothing but the JMP
+static double time_jmp(long long min_instructions, int reps)
+{
+    Case c;
+    c.opcode = 0x4C;
+    c.taken = false;
+    c.instructions = 0;
+    c.prg.assign(PRG_SIZE, 0xEA);
+    size_t at = 0;
+    put(c.prg, at, {0x4C, 0x00, 0x80});
+    CPU cpu;
+    PPU ppu;
+    reset_cpu(cpu, ppu, c);
+    return time_cycles(cpu, min_instructions * JMP_CYCLES, reps) / min_instructions;
+}
+
+static CaseResult run_case(const Case &c, long long min_instructions, int reps, double jmp_ns)
+{
+    CPU cpu;
+    PPU ppu;
+    reset_cpu(cpu, ppu, c);
+    // One untimed pass to learn how many cycles an iteration takes
+    long long cycles_per_iteration = 0;
+    bool left = false;
+    while(!(left && cpu.PC == 0x8000 && cpu.clocks_remain <= 0) && cycles_per_iteration < 100000)
+    {
+        cpu.do_cycle();
+        cycles_per_iteration++;
+        left = left || cpu.PC != 0x8000;
+    }
+    long long iterations = std::max(1LL, min_instructions / c.instructions);
+    long long cycles = iterations * cycles_per_iteration;
+    double median = time_cycles(cpu, cycles, reps);
+    double body_ns = std::max(0.0, median - iterations * jmp_ns);
+    long long body_cycles = cycles_per_iteration - JMP_CYCLES;
+    CaseResult result;
+    result.name = c.name;
+    result.opcode = c.opcode;
+    result.cycles_per_instruction = (double)body_cycles / c.instructions;
+    result.ns_per_instruction = body_ns / (iterations * c.instructions);
+    result.ns_per_cycle = body_ns / (iterations * body_cycles);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    long long instructions = 200000;
+    int reps = 5;
+    bool by_opcode = false;
+    std::string csv_path;
+    std::string only;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--instructions" && i + 1 < argc)
+            instructions = std::max(1LL, std::stoll(argv[++i]));
+        else if(arg == "--reps" && i + 1 < argc)
+            reps = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--by-opcode")
+            by_opcode = true;
+        else if(arg == "--csv" && i + 1 < argc)
+            csv_path = argv[++i];
+        else if(arg == "--only" && i + 1 < argc)
+            only = argv[++i];
+        else
+        {
+            std::cout << "Usage: " << argv[0] << " [--instructions N] [--reps N] [--by-opcode] [--only MNEMONIC] [--csv out.csv]" << std::endl;
+            return 1;
+        }
+    }
+    std::vector<Case> cases;
+    for(const Opcode &op : opcodes)
+    {
+        if(!only.empty() && std::string(op.name).compare(0, only.size(), only) != 0)
+            continue;
+        if(op.mode == REL)
+        {
+            cases.push_back(make_case(op, false, false));
+            cases.push_back(make_case(op, false, true));
+            continue;
+        }
+        cases.push_back(make_case(op, false, false));
+        if(op.mode == ABSX || op.mode == ABSY || op.mode == INDY)
+            cases.push_back(make_case(op, true, false));
+    }
+    double jmp_ns = time_jmp(instructions, reps);
+    std::vector<CaseResult> results;
+    for(const Case &c : cases)
+        results.push_back(run_case(c, instructions, reps, jmp_ns));
+    if(!by_opcode) // Slowest first, which is what you're looking for
+    {
+        std::stable_sort(results.begin(), results.end(), [](const CaseResult &a, const CaseResult &b)
+        {
+            return a.ns_per_instruction > b.ns_per_instruction;
+        });
+    }
+    std::printf("%-4s %-24s %10s %10s %10s\n", "op", "instruction", "cyc/instr", "ns/instr", "ns/cycle");
+    for(const CaseResult &result : results)
+        std::printf("%02X   %-24s %10.2f %10.2f %10.2f\n", result.opcode, result.name.c_str(), result.cycles_per_instruction, result.ns_per_instruction, result.ns_per_cycle);
+    if(!csv_path.empty())
+    {
+        std::ofstream out(csv_path);
+        out << "opcode,instruction,cycles_per_instruction,ns_per_instruction,ns_per_cycle\n";
+        char opcode[3];
+        for(const CaseResult &result : results)
+        {
+            std::snprintf(opcode, sizeof(opcode), "%02X", result.opcode);
+            out << opcode << ",\"" << result.name << "\"," << result.cycles_per_instruction << ','
+                << result.ns_per_instruction << ',' << result.ns_per_cycle << '\n';
+        }
+    }
+    return 0;
+}
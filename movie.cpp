@@ -0,0 +1,34 @@
+#include<fstream>
+
+#include "movie.h"
+#include "cpu.h"
+
+// Input lines look like |0|RLDUTSBA|........||, with any character other
+// than '.' or ' ' meaning the button is held
+bool load_movie(const std::string &path, std::vector<unsigned char> &frames)
+{
+    static const unsigned char order[8] = {BUTTON_RIGHT, BUTTON_LEFT, BUTTON_DOWN, BUTTON_UP,
+        BUTTON_START, BUTTON_SELECT, BUTTON_B, BUTTON_A};
+    std::ifstream in(path);
+    if(!in)
+        return false;
+    frames.clear();
+    std::string line;
+    while(std::getline(in, line))
+    {
+        if(line.empty() || line[0] != '|')
+            continue;
+        size_t port = line.find('|', 1);
+        if(port == std::string::npos)
+            continue;
+        unsigned char buttons = 0;
+        for(int i = 0; i < 8 && port + 1 + i < line.size() && line[port + 1 + i] != '|'; i++)
+        {
+            char c = line[port + 1 + i];
+            if(c != '.' && c != ' ')
+                buttons |= order[i];
+        }
+        frames.push_back(buttons);
+    }
+    return true;
+}
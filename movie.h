@@ -0,0 +1,10 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include<string>
+#include<vector>
+
+// Reads controller 1 from an FCEUX .fm2 movie, one byte of BUTTON_* bits per
+// frame. Only the input log is used; header lines and other ports are ignored.
+bool load_movie(const std::string &path, std::vector<unsigned char> &frames);
+#endif
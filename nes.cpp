@@ -13,56 +13,112 @@
 
 #include "ppu.h"
 #include "cpu.h"
+#include "console.h"
+#include "nesfile.h"
+#include "romdb.h"
+#include "pacer.h"
+#include "rewind.h"
+#include "bootcache.h"
+#include "profiler.h"
+#include "trace.h"
+#include "log.h"
+#include "statehash.h"
 
-class NESFile
+unsigned char read_keyboard()
 {
-public:
-    std::vector<char> prg_rom;
-    std::vector<char> chr_rom;
-    unsigned char flags_six;
-    NESFile(std::vector<char> &buf)
+    unsigned char buttons = 0;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::Z))
+        buttons |= BUTTON_A;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::X))
+        buttons |= BUTTON_B;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::Space))
+        buttons |= BUTTON_SELECT;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::Return))
+        buttons |= BUTTON_START;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::Up))
+        buttons |= BUTTON_UP;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::Down))
+        buttons |= BUTTON_DOWN;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::Left))
+        buttons |= BUTTON_LEFT;
+    if(sf::Keyboard::isKeyPressed(sf::Keyboard::Right))
+        buttons |= BUTTON_RIGHT;
+    return buttons;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *rom_path = nullptr;
+    int frameskip = 4; // Frames emulated without output per shown frame while fast-forwarding
+    size_t rewind_mb = REWIND_DEFAULT_ARENA >> 20;
+    int rewind_interval = 1;
+    int run_ahead = 0; // Frames to run ahead of the real timeline, 0 disables
+    std::string db_path = "nes.db";
+    std::string resume_path; // State file to start from instead of booting
+    std::string trace_path; // Chrome trace of the frame timeline
+    std::string hash_log_path; // Per-frame state hashes, for catching desyncs
+    int hash_every = 1;
+    for(int i = 1; i < argc; i++)
     {
-        std::vector<char> header(buf.begin(), buf.begin()+16);
-        std::cout << "Header size: " << header.size() << std::endl;
-        std::string magic(header.data(), 4);
-        std::cout << magic << std::endl;
-        if(magic != "NES\x1a")
+        std::string arg = argv[i];
+        if(arg == "--frameskip" && i + 1 < argc)
+            frameskip = std::max(0, std::stoi(argv[++i]));
+        else if(arg == "--rewind-mb" && i + 1 < argc)
+            rewind_mb = std::max(0, std::stoi(argv[++i]));
+        else if(arg == "--rewind-interval" && i + 1 < argc)
+            rewind_interval = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--run-ahead" && i + 1 < argc)
+            run_ahead = std::max(0, std::stoi(argv[++i]));
+        else if(arg == "--db" && i + 1 < argc)
+            db_path = argv[++i];
+        else if(arg == "--resume" && i + 1 < argc)
+            resume_path = argv[++i];
+        else if(arg == "--trace" && i + 1 < argc)
+            trace_path = argv[++i];
+        else if(arg == "--hash-log" && i + 1 < argc)
+            hash_log_path = argv[++i];
+        else if(arg == "--hash-every" && i + 1 < argc)
+            hash_every = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "--log" && i + 1 < argc)
         {
-            std::cout << "INVALID MAGIC" << std::endl;
-            return;
+            if(!log_configure(argv[++i]))
+            {
+                std::cout << "BAD LOG SPEC " << argv[i] << std::endl;
+                return 1;
+            }
         }
-        unsigned char prg_rom_size = header[4]; // In 16kb units
-        unsigned char chr_rom_size = header[5]; // In 8kb units
-        flags_six = header[6];
-        unsigned char flags_seven = header[7];
-        unsigned char prg_ram_size = header[8]; // In 8kb units
-        unsigned char flags_nine = header[9];
-        prg_rom = std::vector<char>(buf.begin()+16, buf.begin()+16+16384*prg_rom_size);
-        chr_rom = std::vector<char>(buf.begin()+16+16384*prg_rom_size, buf.begin()+16+16384*prg_rom_size+8192*chr_rom_size);
-        std::cout << prg_rom.size() << std::endl;
+        else
+            rom_path = argv[i];
+    }
+    if(!rom_path)
+    {
+        std::cout << "Usage: " << argv[0] << " [--frameskip N] [--rewind-mb N] [--rewind-interval N] [--run-ahead N] [--db nes.db] [--resume file.state] [--trace trace.json] [--log ppu=debug,...] [--hash-log hashes.txt] [--hash-every N] rom.nes" << std::endl;
+        return 1;
+    }
+    RomDB db;
+    db.load(db_path);
+    std::shared_ptr<const NESFile> nes = NESFile::shared(rom_path, &db);
+    if(!nes->valid)
+    {
+        std::cout << "BAD ROM " << rom_path << ": " << nes->error << std::endl;
+        return 1;
+    }
+    nes->print_header(std::cout);
+    Console console;
+    CPU &cpu = console.cpu;
+    PPU &ppu = console.ppu;
+    std::string save_path = rom_path;
+    size_t dot = save_path.find_last_of('.');
+    if(dot != std::string::npos && save_path.find('/', dot) == std::string::npos)
+        save_path.erase(dot);
+    save_path += ".sav";
+    if(!console.load_cartridge(nes, save_path))
+    {
+        std::cout << "UNSUPPORTED MAPPER " << nes->mapper << std::endl;
+        return 1;
     }
-};
-
-int main(int argc, char *argv[])
-{
-    std::ifstream nes_in(argv[1], std::ios::binary);
-    std::vector<char> nes_buffer((std::istreambuf_iterator<char>(nes_in)), 
-        std::istreambuf_iterator<char>());
-    NESFile nes{nes_buffer};
-    CPU cpu = CPU();
-    PPU ppu = PPU();
-    cpu.ppu = &ppu;
-    ppu.cpu = &cpu;
-    ppu.mirroring = (nes.flags_six & 0x1);
-    std::cout << "PRG ROM SIZE: " << nes.prg_rom.size() << std::endl;
-    std::cout << "CHR ROM SIZE: " << nes.chr_rom.size() << std::endl;
-    std::copy(nes.prg_rom.begin(), nes.prg_rom.end(), &(cpu.int_memory[0x10000-nes.prg_rom.size()]));
-    std::copy(nes.chr_rom.begin(), nes.chr_rom.begin() + 0x1000, &(ppu.pattern_tables[0][0]));
-    std::copy(nes.chr_rom.begin() + 0x1000, nes.chr_rom.end(), &(ppu.pattern_tables[1][0]));
-    unsigned short reset_addr = (cpu.int_memory[0xfffd] << 8) + cpu.int_memory[0xfffc];
-    cpu.PC = reset_addr;
     //cpu.PC = 0xC000;
-    std::cout << "RESETTING TO 0x" << std::hex << reset_addr << std::dec  << std::endl;
+    std::cout << "RESETTING TO 0x" << std::hex << cpu.PC << std::dec  << std::endl;
     ppu.vram_addr_high_byte = true;
 
     ppu.buffer = new sf::Uint8[61440*4];
@@ -72,52 +128,146 @@ int main(int argc, char *argv[])
     sf::Sprite sprite;
     sprite.setTexture(text);
     sprite.setPosition(0, 0);
-    sf::Clock clock;
-    sf::Time start = clock.getElapsedTime();
-    int frame = 0;
-    window.setFramerateLimit(60);
+    FramePacer pacer;
+    std::string state_path = std::string(rom_path) + ".state";
+    SaveState state;
+    if(!resume_path.empty())
+    {
+        if(read_state_file(resume_path, state) && console.load_state(state))
+            std::cout << "RESUMED FROM " << resume_path << std::endl;
+        else
+            std::cout << "CAN'T RESUME FROM " << resume_path << " (BAD FILE OR ANOTHER ROM), BOOTING" << std::endl;
+    }
+    BootCache boot_cache;
+    SaveState ahead_state;
+    RewindBuffer rewind(rewind_mb << 20, rewind_interval);
+    if(console.battery.data)
+        std::cout << "BATTERY SAVE IN " << console.battery.path << std::endl;
+    int frames_since_flush = 0;
+    HashLog hash_log;
+    if(!hash_log_path.empty() && !hash_log.open(hash_log_path, hash_every))
+        std::cout << "CAN'T WRITE " << hash_log_path << std::endl;
+#ifdef NES_PROFILE
+    install_profile_signal();
+#endif
+    if(!trace_path.empty())
+    {
+        if(trace_start(trace_path))
+        {
+            trace_thread_name("main");
+            std::cout << "TRACING TO " << trace_path << std::endl;
+        }
+        else
+            std::cout << "CAN'T TRACE TO " << trace_path << std::endl;
+    }
     while(window.isOpen())
     {
-        for(int i =0; i < 29781; i++)
         {
-            ppu.do_cycle();
-            ppu.do_cycle();
-            ppu.do_cycle();
-            cpu.do_cycle();
+            TraceSpan span("input");
+            cpu.controller_buttons = window.hasFocus() ? read_keyboard() : 0;
+        }
+        if(window.hasFocus() && sf::Keyboard::isKeyPressed(sf::Keyboard::BackSpace) && rewind.rewind(console))
+            console.preview_frames(1, ahead_state); // The framebuffer isn't part of the state, redraw it without moving on
+        else
+        {
+            if(window.hasFocus() && sf::Keyboard::isKeyPressed(sf::Keyboard::Tab)) // Fast-forward
+            {
+                for(int i = 0; i < frameskip; i++)
+                {
+                    console.run_frame(false);
+                    rewind.capture(console);
+                    hash_log.frame_done(console);
+                }
+            }
+            console.run_frame_ahead(run_ahead, ahead_state);
+            rewind.capture(console);
+            hash_log.frame_done(console);
+        }
+        window.setTitle(std::to_string(pacer.fps()));
+        {
+            auto scope = console.profiler.scope(PROFILE_DUMP_IO);
+            TraceSpan span("dump io");
+            std::ofstream out("dump", std::ios::out | std::ios::binary);
+            unsigned char ppu_buffer[0x4000];
+            ppu.dump_memory(ppu_buffer);
+            out.write((char *)ppu_buffer, 0x4000);
+            out.close();
+            if(console.battery.data && ++frames_since_flush >= 600) // Write back roughly every ten seconds
+            {
+                console.battery.flush();
+                frames_since_flush = 0;
+            }
+            unsigned char *prg_ram = console.mapper->prg_ram();
+            if(prg_ram && prg_ram[1] == 0xDE && prg_ram[2] == 0xB0 && prg_ram[3] == 0x61) // Test ROM output signature
+            {
+                std::ofstream test_out("test_out", std::ios::out);
+                test_out.write((char *)&prg_ram[4], MAPPER_PRG_RAM_SIZE - 4);
+                test_out.close();
+            }
         }
-        sf::Time curr = clock.getElapsedTime();
-        float fps = (ppu.frame - frame)/(curr.asSeconds() - start.asSeconds());
-        start = curr;
-        frame = ppu.frame;
-        window.setTitle(std::to_string(fps));    
-        std::ofstream out("dump", std::ios::out | std::ios::binary);
-        unsigned char ppu_buffer[0x4000];
-        ppu.dump_memory(ppu_buffer);
-        out.write((char *)ppu_buffer, 0x4000);
-        out.close();
-        std::ofstream test_out("test_out", std::ios::out);
-        test_out.write((char *)&(cpu.int_memory[0x6004]),0x2000);
-        test_out.close();
         if(cpu.S > 0x1ff || cpu.S < 0x100)
         {
             std::cout << "STACK BLOWN" << std::endl;
             while(1);
         }
             
-        window.clear(sf::Color(255, 255, 255));
-        //ppu.render(buffer);
-
-        text.update(ppu.buffer);
+        {
+            auto scope = console.profiler.scope(PROFILE_PRESENT);
+            TraceSpan span("draw");
+            window.clear(sf::Color(255, 255, 255));
+            //ppu.render(buffer);
 
-        window.draw(sprite);
+            text.update(ppu.buffer);
 
-        window.display();
+            window.draw(sprite);
+        }
+        {
+            auto scope = console.profiler.scope(PROFILE_PACING);
+            TraceSpan span("pacing");
+            pacer.wait();
+        }
+        {
+            auto scope = console.profiler.scope(PROFILE_PRESENT);
+            TraceSpan span("present");
+            window.display();
+        }
+#ifdef NES_PROFILE
+        if(profile_report_requested())
+            console.profiler.print_report(std::cout);
+#endif
         sf::Event event;
+        TraceSpan events_span("events");
         while(window.pollEvent(event))
         {
             if(event.type == sf::Event::Closed)
                 window.close();
+            else if(event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F1)
+            {
+                pacer.print_stats(std::cout);
+                rewind.print_stats(std::cout);
+            }
+            else if(event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F2)
+            {
+                if(boot_cache.reset(console))
+                    std::cout << "RESET" << std::endl;
+            }
+            else if(event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F5)
+            {
+                console.save_state(state);
+                if(write_state_file(state_path, state))
+                    std::cout << "SAVED STATE TO " << state_path << std::endl;
+            }
+            else if(event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F8)
+            {
+                if(read_state_file(state_path, state) && console.load_state(state))
+                    std::cout << "LOADED STATE FROM " << state_path << std::endl;
+                else
+                    std::cout << "CAN'T LOAD STATE FROM " << state_path << " (BAD FILE OR ANOTHER ROM)" << std::endl;
+            }
         }
     }
-
+    pacer.print_stats(std::cout);
+    rewind.print_stats(std::cout);
+    console.profiler.print_report(std::cout);
+    trace_stop();
 }
@@ -0,0 +1,221 @@
+#include<iostream>
+#include<algorithm>
+#include<mutex>
+#include<unordered_map>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<fcntl.h>
+#include<unistd.h>
+
+#include "nesfile.h"
+#include "romdb.h"
+
+NESFile::NESFile(const std::string &path)
+{
+    valid = false;
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        error = "can't open " + path;
+        return;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map != MAP_FAILED)
+        {
+            data = (const unsigned char *)map;
+            size = st.st_size;
+            mapped = true;
+        }
+    }
+    close(fd);
+    if(!mapped)
+    {
+        error = "can't map " + path;
+        return;
+    }
+    parse();
+}
+
+NESFile::NESFile(std::vector<unsigned char> image) : owned(std::move(image))
+{
+    valid = false;
+    data = owned.data();
+    size = owned.size();
+    mapped = false;
+    parse();
+}
+
+NESFile::~NESFile()
+{
+    if(mapped)
+        munmap((void *)data, size);
+}
+
+// NES 2.0 ROM sizes: a 12 bit count of units, or when the high nibble is
+// $F, an exponent-multiplier pair packed into the low byte.
+static size_t nes2_rom_size(unsigned char lsb, unsigned char msb, size_t unit)
+{
+    if(msb == 0xF)
+    {
+        int exponent = lsb >> 2;
+        int multiplier = (lsb & 0x3) * 2 + 1;
+        return exponent < 40 ? ((size_t)1 << exponent) * multiplier : 0;
+    }
+    return ((msb << 8) | lsb) * unit;
+}
+
+static size_t nes2_ram_size(unsigned char shift)
+{
+    return shift ? (size_t)64 << shift : 0;
+}
+
+void NESFile::parse()
+{
+    prg_rom = nullptr;
+    chr_rom = nullptr;
+    prg_rom_size = 0;
+    chr_rom_size = 0;
+    db_fixed = false;
+    crc = 0;
+    if(size < INES_HEADER_SIZE || std::string((const char *)data, 4) != "NES\x1a")
+    {
+        error = "invalid magic";
+        return;
+    }
+    const unsigned char *header = data;
+    flags_six = header[6];
+    flags_seven = header[7];
+    nes2 = (flags_seven & 0x0C) == 0x08;
+    mirroring = flags_six & 0x1; // MIRROR_VERTICAL when set
+    battery = flags_six & 0x2;
+    trainer = flags_six & 0x4;
+    four_screen = flags_six & 0x8;
+    if(nes2)
+    {
+        mapper = ((header[8] & 0x0F) << 8) | (flags_seven & 0xF0) | (flags_six >> 4);
+        submapper = header[8] >> 4;
+        prg_rom_size = nes2_rom_size(header[4], header[9] & 0x0F, 0x4000);
+        chr_rom_size = nes2_rom_size(header[5], header[9] >> 4, 0x2000);
+        prg_ram_size = nes2_ram_size(header[10] & 0x0F);
+        prg_nvram_size = nes2_ram_size(header[10] >> 4);
+        chr_ram_size = nes2_ram_size(header[11] & 0x0F);
+        chr_nvram_size = nes2_ram_size(header[11] >> 4);
+        region = header[12] & 0x3;
+    }
+    else
+    {
+        // Old dumping tools wrote signatures like "DiskDude!" over bytes
+        // 7-15; if the tail isn't zero the upper mapper nibble is junk.
+        bool dirty = header[12] || header[13] || header[14] || header[15];
+        mapper = (dirty ? 0 : (flags_seven & 0xF0)) | (flags_six >> 4);
+        submapper = 0;
+        prg_rom_size = header[4] * 0x4000;
+        chr_rom_size = header[5] * 0x2000;
+        size_t ram = (header[8] ? header[8] : 1) * 0x2000;
+        prg_ram_size = battery ? 0 : ram;
+        prg_nvram_size = battery ? ram : 0;
+        chr_ram_size = chr_rom_size ? 0 : 0x2000;
+        chr_nvram_size = 0;
+        region = (!dirty && (header[9] & 0x1)) ? REGION_PAL : REGION_NTSC;
+    }
+    size_t offset = INES_HEADER_SIZE + (trainer ? INES_TRAINER_SIZE : 0);
+    if(prg_rom_size < 0x2000 || prg_rom_size % 0x2000 || chr_rom_size % 0x400)
+    {
+        error = "unsupported PRG/CHR ROM size";
+        return;
+    }
+    if(offset + prg_rom_size + chr_rom_size > size)
+    {
+        error = "truncated: header says " + std::to_string(offset + prg_rom_size + chr_rom_size)
+            + " bytes, file has " + std::to_string(size);
+        return;
+    }
+    prg_rom = data + offset;
+    chr_rom = chr_rom_size ? data + offset + prg_rom_size : nullptr;
+    crc = crc32(prg_rom, prg_rom_size);
+    if(chr_rom)
+        crc = crc32(chr_rom, chr_rom_size, crc);
+    valid = true;
+}
+
+void NESFile::sha1(unsigned char digest[SHA1_SIZE]) const
+{
+    SHA1 hash;
+    hash.update(prg_rom, prg_rom_size);
+    if(chr_rom)
+        hash.update(chr_rom, chr_rom_size);
+    hash.finish(digest);
+}
+
+void NESFile::apply_fix(const RomDBEntry &entry)
+{
+    if(entry.mapper >= 0)
+        mapper = entry.mapper;
+    if(entry.submapper >= 0)
+        submapper = entry.submapper;
+    if(entry.mirroring >= 0)
+        mirroring = entry.mirroring;
+    if(entry.four_screen >= 0)
+        four_screen = entry.four_screen;
+    if(entry.battery >= 0)
+    {
+        size_t ram = std::max(prg_ram_size + prg_nvram_size, (size_t)0x2000);
+        battery = entry.battery;
+        prg_ram_size = battery ? 0 : ram;
+        prg_nvram_size = battery ? ram : 0;
+    }
+    if(entry.prg_ram_size >= 0)
+    {
+        if(battery)
+            prg_nvram_size = entry.prg_ram_size;
+        else
+            prg_ram_size = entry.prg_ram_size;
+    }
+    if(entry.region >= 0)
+        region = entry.region;
+    db_fixed = true;
+}
+
+void NESFile::print_header(std::ostream &out) const
+{
+    static const char *regions[] = {"NTSC", "PAL", "multi", "Dendy"};
+    out << (nes2 ? "NES 2.0" : "iNES") << " mapper " << mapper << "." << submapper
+        << ", PRG ROM " << prg_rom_size << ", CHR ROM " << chr_rom_size
+        << ", PRG RAM " << prg_ram_size << ", PRG NVRAM " << prg_nvram_size
+        << ", CHR RAM " << chr_ram_size << ", "
+        << (four_screen ? "four-screen" : mirroring ? "vertical" : "horizontal")
+        << (battery ? ", battery" : "") << ", " << regions[region & 0x3]
+        << ", CRC32 " << std::hex << crc << std::dec
+        << (db_fixed ? " (header fixed from database)" : "") << std::endl;
+}
+
+std::shared_ptr<const NESFile> NESFile::shared(const std::string &path, const RomDB *db)
+{
+    static std::mutex lock;
+    static std::unordered_map<std::string, std::weak_ptr<const NESFile>> open_files;
+    std::lock_guard<std::mutex> guard(lock);
+    // Drop ROMs nobody holds any more, so a batch over a big library keeps
+    // entries for the open files only
+    for(auto it = open_files.begin(); it != open_files.end();)
+    {
+        if(it->second.expired())
+            it = open_files.erase(it);
+        else
+            ++it;
+    }
+    auto found = open_files.find(path);
+    std::shared_ptr<const NESFile> rom = found != open_files.end() ? found->second.lock() : nullptr;
+    if(rom)
+        return rom;
+    std::shared_ptr<NESFile> loaded = std::make_shared<NESFile>(path);
+    if(loaded->valid && db)
+        db->apply(*loaded);
+    open_files[path] = loaded;
+    return loaded;
+}
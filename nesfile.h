@@ -0,0 +1,71 @@
+#ifndef NESFILE_H
+#define NESFILE_H
+
+#include<string>
+#include<vector>
+#include<memory>
+#include<iostream>
+#include<cstddef>
+
+#include "hash.h"
+
+#define REGION_NTSC 0
+#define REGION_PAL 1
+#define REGION_MULTI 2
+#define REGION_DENDY 3
+
+#define INES_HEADER_SIZE 16
+#define INES_TRAINER_SIZE 512
+
+struct RomDBEntry;
+class RomDB;
+
+// An iNES / NES 2.0 image. Files are mmapped read-only and PRG/CHR point
+// straight into the mapping, so loading copies nothing; images built in
+// memory are owned instead. Either way the data must outlive any mapper
+// using it, which is why consoles hold ROMs through shared pointers.
+class NESFile
+{
+public:
+    NESFile(const std::string &path);
+    NESFile(std::vector<unsigned char> image);
+    ~NESFile();
+    NESFile(const NESFile &) = delete;
+    NESFile &operator=(const NESFile &) = delete;
+    bool valid;
+    std::string error;
+    const unsigned char *prg_rom;
+    size_t prg_rom_size;
+    const unsigned char *chr_rom; // nullptr when the board has CHR RAM
+    size_t chr_rom_size;
+    unsigned char flags_six;
+    unsigned char flags_seven;
+    bool nes2;
+    int mapper;
+    int submapper;
+    size_t prg_ram_size; // Volatile and battery-backed PRG RAM, in bytes
+    size_t prg_nvram_size;
+    size_t chr_ram_size;
+    size_t chr_nvram_size;
+    bool battery;
+    bool trainer;
+    bool four_screen;
+    unsigned char mirroring; // MIRROR_HORIZONTAL or MIRROR_VERTICAL, from the header; four_screen overrides it
+    int region;
+    unsigned int crc; // CRC32 of PRG + CHR, the key ROM databases use
+    bool db_fixed; // Header fields were corrected from a database entry
+    void sha1(unsigned char digest[SHA1_SIZE]) const; // Of PRG + CHR
+    void apply_fix(const RomDBEntry &entry);
+    void print_header(std::ostream &out) const;
+    // Every caller asking for the same path while it's still loaded gets the
+    // same image, so any number of consoles running one game share a single
+    // read-only copy of its ROM. db fixes are applied when it's first opened.
+    static std::shared_ptr<const NESFile> shared(const std::string &path, const RomDB *db = nullptr);
+private:
+    const unsigned char *data;
+    size_t size;
+    bool mapped;
+    std::vector<unsigned char> owned;
+    void parse();
+};
+#endif
@@ -0,0 +1,142 @@
+#include<thread>
+#include<algorithm>
+#include<iomanip>
+#include<string>
+
+#include "pacer.h"
+
+static int bucket_for(float ms)
+{
+    int bucket = (int)(ms * 1000 / PACER_BUCKET_US);
+    return std::min(std::max(bucket, 0), PACER_BUCKETS - 1);
+}
+
+static double histogram_percentile(const unsigned int *hist, int count, double p)
+{
+    if(count == 0)
+        return 0;
+    unsigned int target = (unsigned int)(p * (count - 1)) + 1;
+    unsigned int seen = 0;
+    for(int i = 0; i < PACER_BUCKETS; i++)
+    {
+        seen += hist[i];
+        if(seen >= target)
+            return (i + 1) * PACER_BUCKET_US / 1000.0; // Upper edge of the bucket
+    }
+    return PACER_BUCKETS * PACER_BUCKET_US / 1000.0;
+}
+
+FramePacer::FramePacer(double rate, std::chrono::nanoseconds spin)
+{
+    spin_window = spin;
+    set_rate(rate);
+    reset();
+}
+
+void FramePacer::set_rate(double rate)
+{
+    period = std::chrono::nanoseconds((long long)(1e9 / rate));
+}
+
+void FramePacer::reset()
+{
+    std::fill(frame_times, frame_times + PACER_HISTORY, 0);
+    std::fill(lateness, lateness + PACER_HISTORY, 0);
+    std::fill(frame_time_hist, frame_time_hist + PACER_BUCKETS, 0);
+    std::fill(lateness_hist, lateness_hist + PACER_BUCKETS, 0);
+    history_pos = 0;
+    history_count = 0;
+    frame_time_sum = 0;
+    missed_deadlines = 0;
+    last_frame = clock::now();
+    deadline = last_frame;
+}
+
+void FramePacer::wait()
+{
+    deadline += period;
+    clock::time_point now = clock::now();
+    if(deadline - now > spin_window)
+        std::this_thread::sleep_until(deadline - spin_window);
+    while(clock::now() < deadline); // Spin off the remainder, sleep_until overshoots by too much
+    now = clock::now();
+
+    std::chrono::duration<float, std::milli> late = now - deadline;
+    std::chrono::duration<float, std::milli> frame_time = now - last_frame;
+    record(frame_time.count(), late.count());
+    last_frame = now;
+
+    if(now - deadline > period)
+    {
+        // More than a frame behind: start over from here rather than
+        // rushing a burst of frames out to catch up.
+        missed_deadlines++;
+        deadline = now;
+    }
+}
+
+void FramePacer::record(float frame_ms, float late_ms)
+{
+    if(history_count == PACER_HISTORY)
+    {
+        frame_time_hist[bucket_for(frame_times[history_pos])]--;
+        lateness_hist[bucket_for(lateness[history_pos])]--;
+        frame_time_sum -= frame_times[history_pos];
+    }
+    else
+        history_count++;
+    frame_times[history_pos] = frame_ms;
+    lateness[history_pos] = late_ms;
+    frame_time_hist[bucket_for(frame_ms)]++;
+    lateness_hist[bucket_for(late_ms)]++;
+    frame_time_sum += frame_ms;
+    history_pos = (history_pos + 1) % PACER_HISTORY;
+}
+
+int FramePacer::samples() const
+{
+    return history_count;
+}
+
+double FramePacer::mean_frame_time() const
+{
+    return history_count ? frame_time_sum / history_count : 0;
+}
+
+double FramePacer::fps() const
+{
+    return frame_time_sum > 0 ? history_count * 1000.0 / frame_time_sum : 0;
+}
+
+double FramePacer::frame_time_percentile(double p) const
+{
+    return histogram_percentile(frame_time_hist, history_count, p);
+}
+
+double FramePacer::lateness_percentile(double p) const
+{
+    return histogram_percentile(lateness_hist, history_count, p);
+}
+
+void FramePacer::print_stats(std::ostream &out) const
+{
+    out << std::fixed << std::setprecision(3);
+    out << "[PACER] " << history_count << " frames, target " << period.count() / 1e6 << " ms, "
+        << fps() << " fps, " << missed_deadlines << " missed deadlines" << std::endl;
+    out << "[PACER] frame time ms: mean " << mean_frame_time()
+        << " p50 " << frame_time_percentile(0.5)
+        << " p95 " << frame_time_percentile(0.95)
+        << " p99 " << frame_time_percentile(0.99) << std::endl;
+    out << "[PACER] lateness ms:   p50 " << lateness_percentile(0.5)
+        << " p95 " << lateness_percentile(0.95)
+        << " p99 " << lateness_percentile(0.99) << std::endl;
+    for(int i = 0; i < PACER_BUCKETS; i++)
+    {
+        if(frame_time_hist[i] == 0)
+            continue;
+        out << "[PACER] " << std::setw(7) << i * PACER_BUCKET_US / 1000.0 << " ms | "
+            << std::string(std::max(1u, frame_time_hist[i] * 60 / history_count), '#')
+            << " " << frame_time_hist[i] << std::endl;
+    }
+    out << std::defaultfloat;
+}
@@ -0,0 +1,44 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include<chrono>
+#include<iostream>
+
+#define NES_FRAME_RATE 60.0988 // NTSC: 21.477272 MHz / 4 / 341 / 262 * 2 / (2 - 1/341)
+
+#define PACER_HISTORY 600 // Rolling window, ~10 seconds of frames
+#define PACER_BUCKET_US 250
+#define PACER_BUCKETS 200 // 0-50ms in 0.25ms buckets, last bucket catches everything above
+
+// Paces frames against absolute deadlines instead of sleeping a fixed amount
+// after each frame, so sleep overshoot doesn't accumulate into drift.
+class FramePacer
+{
+public:
+    typedef std::chrono::steady_clock clock;
+    FramePacer(double rate = NES_FRAME_RATE, std::chrono::nanoseconds spin = std::chrono::microseconds(500));
+    void wait();
+    void reset();
+    void set_rate(double rate);
+    double fps() const;
+    double frame_time_percentile(double p) const; // In ms
+    double lateness_percentile(double p) const; // In ms
+    double mean_frame_time() const;
+    int samples() const;
+    unsigned long missed_deadlines;
+    void print_stats(std::ostream &out) const;
+    std::chrono::nanoseconds spin_window; // Sleep until this long before the deadline, then busy-wait
+private:
+    std::chrono::nanoseconds period;
+    clock::time_point deadline;
+    clock::time_point last_frame;
+    float frame_times[PACER_HISTORY];
+    float lateness[PACER_HISTORY];
+    unsigned int frame_time_hist[PACER_BUCKETS];
+    unsigned int lateness_hist[PACER_BUCKETS];
+    int history_pos;
+    int history_count;
+    double frame_time_sum;
+    void record(float frame_ms, float late_ms);
+};
+#endif
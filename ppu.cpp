@@ -1,6 +1,8 @@
 #include "ppu.h"
+#include "mapper.h"
+#include "log.h"
 
-unsigned char palette_colors[192] = {124,124,124,
+static const unsigned char palette_colors[192] = {124,124,124,
 0,0,252,
 0,0,188,
 68,40,188,
@@ -65,7 +67,11 @@ unsigned char palette_colors[192] = {124,124,124,
 0,0,0,
 0,0,0};
 
-int mod(int a, int b) {
+// Never written: the PPU only writes CHR when a mapper has set chr_ram, and
+// then every page points at the board
+static unsigned char unmapped_chr[0x400];
+
+static int mod(int a, int b) {
     return a >= 0 ? a % b : ( b - abs( a%b ) ) % b;
 }
 
@@ -84,16 +90,11 @@ void PPU::do_cycle()
                 dot = 0;
             }
             frame++;
-            //std::cout << "FRAME: " << frame << std::endl;
+            NES_LOG(LOG_PPU, LOG_DEBUG, "FRAME {}", frame);
         }
     }
     if(dot == 300)
-    {
-        attr_data = std::queue<unsigned char>();
-        tile_low_byte = std::queue<unsigned char>();
-        tile_high_byte = std::queue<unsigned char>();
-        nametable_byte = std::queue<unsigned char>();
-    }
+        tile_queue_size = 0;
     if(dot == 257 && ((PPUMASK & 0x8) || (PPUMASK & 0x10)) && scanline < 240)
     {
         vram_addr &= ~0x41F;
@@ -105,11 +106,11 @@ void PPU::do_cycle()
         {
             vram_addr &= ~0x001F; // coarse X = 0
             vram_addr ^= 0x400; // Switch nametable;
-            //std::cout << "SWTICHING HORIZ NAMETABLE" << std::endl;
+            NES_LOG(LOG_PPU, LOG_TRACE, "SWITCHING HORIZ NAMETABLE");
         }
         else
         {
-            //std::cout << "INCREMENTING VRAM ADDR AT DOT " << dot << std::endl;
+            NES_LOG(LOG_PPU, LOG_TRACE, "INCREMENTING VRAM ADDR AT DOT {}", dot);
             vram_addr += 1;
         }
     }
@@ -125,7 +126,7 @@ void PPU::do_cycle()
             if (y == 29)
             {
                 y = 0;                          // coarse Y = 0
-                //std::cout << "SWITCHING VERT NAMETABLE" << std::endl;
+                NES_LOG(LOG_PPU, LOG_TRACE, "SWITCHING VERT NAMETABLE");
                 vram_addr ^= 0x0800;                    // switch vertical nametable
             }
             else if (y == 31)
@@ -135,6 +136,22 @@ void PPU::do_cycle()
             vram_addr = (vram_addr & ~0x03E0) | (y << 5)  ;   // put coarse Y back into v 
         }
     }
+    if(a12_watch && (dot == 260 || dot == 324) && ((PPUMASK & 0x8) || (PPUMASK & 0x10)) && scanline < 240)
+    {
+        // PPU address line A12 rises once per scanline, when fetches move
+        // from the $0xxx pattern table to the $1xxx one: at the sprite
+        // fetches if sprites use $1000, else at the next line's background
+        // fetches if the background does. Nametable fetches in between are
+        // too short for the mapper to see as A12 going low.
+        bool sprites_high = PPUCTRL & 0x08;
+        bool bg_high = PPUCTRL & 0x10;
+        if((dot == 260 && sprites_high && !bg_high) || (dot == 324 && bg_high && !sprites_high))
+            mapper->ppu_a12_rise();
+    }
+    // When the frame won't be shown the background pipeline only feeds sprite 0
+    // hit, so skip it on lines where that can't happen. Fetches and queue pops
+    // are gated by the same condition so the queues stay balanced.
+    bool bg_pipeline = !skip_render || (sprite_zero_on_line && !(PPUSTATUS & 0x40));
     switch(scanline)
     {
         case -1:
@@ -150,36 +167,42 @@ void PPU::do_cycle()
                 vram_addr &= ~0x7BE0;
                 vram_addr |= vram_addr_temp & 0x7BE0;
             }
-            if(dot == 321 || dot == 329)
+            if((dot == 321 || dot == 329) && bg_pipeline)
                 fetch_tile_data();
             break;
         case 0 ... 239:
-            if(((mod(dot-fine_x - 1, 8) == 0) && (dot-fine_x <= 249) && dot > 0) || (dot == 321) || (dot == 329))
+            if(!bg_pipeline)
+                ;
+            else if(((mod(dot-fine_x - 1, 8) == 0) && (dot-fine_x <= 249) && dot > 0) || (dot == 321) || (dot == 329))
             {
-               // std::cout << "FETCHING TILE AT DOT " << dot << std::endl;
+                NES_LOG(LOG_PPU, LOG_TRACE, "FETCHING TILE AT DOT {}", dot);
                 fetch_tile_data();
             }
-            if((mod(dot + fine_x, 8) == 0 && (dot+fine_x) < 256) || dot == 0)
+            if(bg_pipeline && ((mod(dot + fine_x, 8) == 0 && (dot+fine_x) < 256) || dot == 0))
             {
-                if(attr_data.size() == 0)
-                    std::cout << "EMPTY QUEUE" << std::endl;
-                //std::cout << "UPDATING TILE AT DOT " << dot << std::endl;
-                curr_attr_data = attr_data.front();
-                curr_nametable_byte = nametable_byte.front();
-                curr_tile_low_byte = tile_low_byte.front();
-                curr_tile_high_byte = tile_high_byte.front();
-                attr_data.pop();
-                nametable_byte.pop();
-                tile_low_byte.pop();
-                tile_high_byte.pop();
-
+                if(tile_queue_size == 0)
+                    NES_LOG(LOG_PPU, LOG_WARN, "EMPTY QUEUE AT SCANLINE {} DOT {}", scanline, dot);
+                NES_LOG(LOG_PPU, LOG_TRACE, "UPDATING TILE AT DOT {}", dot);
+                TileData &tile = tile_queue[tile_queue_head];
+                curr_attr_data = tile.attr_data;
+                curr_nametable_byte = tile.nametable_byte;
+                curr_tile_low_byte = tile.tile_low_byte;
+                curr_tile_high_byte = tile.tile_high_byte;
+                tile_queue_head = (tile_queue_head + 1) % PPU_TILE_QUEUE_SIZE;
+                tile_queue_size = std::max(tile_queue_size - 1, 0);
             }
             if(dot == 260)
             {
-                std::fill(sprite_dots, sprite_dots+256, 0);
+                // Only sprite 0 matters for timing when the frame won't be
+                // shown, except on the last line: it leaves sprite_dots as
+                // scanline 0 of the next frame sees them, which may be shown
+                bool all_sprites = !skip_render || scanline == 239;
+                if(all_sprites)
+                    std::fill(sprite_dots, sprite_dots+256, 0);
                 std::fill(sprite_zero_pixels, sprite_zero_pixels+8, -1);
                 
-                for(int i = 0; i < 64; i++)
+                int sprite_count = all_sprites ? 64 : 1;
+                for(int i = 0; i < sprite_count; i++)
                 {
                     unsigned char *oam_data = &(OAM[i*4]);
                     unsigned char x = oam_data[3];
@@ -190,8 +213,9 @@ void PPU::do_cycle()
                         unsigned char palette_sel = (oam_data[2] & 0x3) + 4;
                         unsigned char tile = oam_data[1];
                         unsigned char pattern_table_spr = std::bitset<8>(PPUCTRL)[3];
-                        unsigned char low_byte = pattern_tables[pattern_table_spr][(tile<<4)+(scanline - oam_data[0])];
-                        unsigned char high_byte = pattern_tables[pattern_table_spr][(tile<<4)+((scanline - oam_data[0]) + 8)];  
+                        unsigned short pattern_addr = (pattern_table_spr << 12) + (tile<<4) + (scanline - oam_data[0]);
+                        unsigned char low_byte = chr_pages[pattern_addr >> 10][pattern_addr & 0x3FF];
+                        unsigned char high_byte = chr_pages[(pattern_addr + 8) >> 10][(pattern_addr + 8) & 0x3FF];
                         if(oam_data[2] & 0x40) // Horizontal flip
                         {
                             for(int j = 7; j >= 0; j--)
@@ -228,6 +252,7 @@ void PPU::do_cycle()
                         }
                     }
                 }
+                sprite_zero_on_line = *std::max_element(std::begin(sprite_zero_pixels), std::end(sprite_zero_pixels)) >= 0;
             }
             if(dot == 2 && sprite_zero_pending)
             {
@@ -240,16 +265,15 @@ void PPU::do_cycle()
                 int x = dot/8;
                 int i = dot % 8;
                 int y = scanline;
-                if(PPUMASK & 0x8)
+                if((PPUMASK & 0x8) && bg_pipeline)
                 {
-                    int scrolled_x = (vram_addr & 0x1F);
-                    int scrolled_y = ((vram_addr >> 5) & 0x1F)*8 + ((vram_addr >> 12) & 0x7);
                     int scrolled_i = mod(dot + fine_x, 8);
-                    //std::cout << "TILE AT (" << x << "," << y << "): GOT " << (int)curr_nametable_byte << std::endl;
-                    //std::cout << "ATTR_INDEX FOR (" << dot << "," << y <<") :" << (int)attr_index << std::endl;
+                    NES_LOG(LOG_PPU, LOG_TRACE, "TILE AT ({}, {}): GOT {}", x, y, curr_nametable_byte);
 
                     unsigned char pixel_on = ((curr_tile_low_byte >> (7-scrolled_i)) & 0x1) + ((curr_tile_high_byte >> (7-scrolled_i)) & 0x1);
-                    if(pixel_on != 0)
+                    if(skip_render)
+                        bg_opaque[dot] = pixel_on != 0; // Still needed for sprite 0 hit
+                    else if(pixel_on != 0)
                     {
                         buffer[(y*32*8 + dot)*4] = palette_colors[palette[(curr_attr_data*4 + pixel_on)]*3];
                         buffer[(y*32*8 + dot)*4 + 1] = palette_colors[palette[(curr_attr_data*4 + pixel_on)]*3+1];
@@ -266,7 +290,7 @@ void PPU::do_cycle()
                         bg_opaque[dot] = false;
                     }
                 }
-                if(PPUMASK & 0x10)
+                if((PPUMASK & 0x10) && !skip_render)
                 {
                     if(sprite_dots[dot] != 0)
                     {
@@ -295,7 +319,7 @@ void PPU::do_cycle()
         case 241:
             if(dot == 1)
             {
-                //std::cout << "[PPU] FINISHED VISIBLE RENDER" << std::endl;
+                NES_LOG(LOG_PPU, LOG_DEBUG, "VBLANK AT FRAME {}", frame);
                 NMI_occurred = true;
                 PPUSTATUS |= 0x80;
             }
@@ -311,14 +335,21 @@ void PPU::fetch_tile_data()
     unsigned char pattern_table_bg = std::bitset<8>(PPUCTRL)[4];
     int scrolled_x = (vram_addr & 0x1F);
     int scrolled_y = ((vram_addr >> 5) & 0x1F)*8 + ((vram_addr >> 12) & 0x7);
-    unsigned char tile = read_memory(0x2000 | (vram_addr & 0xFFF));
-    //std::cout << "READING TILE AT " << (int) (vram_addr & 0xFFF) << " GOT " << (int) tile <<std::endl;
-    nametable_byte.push(tile);
-    unsigned char low_byte = pattern_tables[pattern_table_bg][(tile<<4)+scrolled_y%8];
-    tile_low_byte.push(low_byte);
-    unsigned char high_byte = pattern_tables[pattern_table_bg][(tile<<4)+(scrolled_y%8)+8];
-    tile_high_byte.push(high_byte);
-    unsigned char attr_byte = read_memory(0x23C0 | (vram_addr & 0x0C00) | ((vram_addr >> 4) & 0x38) | ((vram_addr >> 2) & 0x07));
+    if(tile_queue_size == PPU_TILE_QUEUE_SIZE)
+    {
+        NES_LOG(LOG_PPU, LOG_WARN, "FULL QUEUE AT SCANLINE {} DOT {}", scanline, dot);
+        return;
+    }
+    TileData &data = tile_queue[(tile_queue_head + tile_queue_size) % PPU_TILE_QUEUE_SIZE];
+    tile_queue_size++;
+    const unsigned char *nametable = nametable_pages[(vram_addr >> 10) & 0x3];
+    unsigned char tile = nametable[vram_addr & 0x3FF];
+    NES_LOG(LOG_PPU, LOG_TRACE, "READING TILE AT {x} GOT {x}", vram_addr & 0xFFF, tile);
+    data.nametable_byte = tile;
+    unsigned short pattern_addr = (pattern_table_bg << 12) + (tile<<4) + scrolled_y%8;
+    data.tile_low_byte = chr_pages[pattern_addr >> 10][pattern_addr & 0x3FF];
+    data.tile_high_byte = chr_pages[(pattern_addr + 8) >> 10][(pattern_addr + 8) & 0x3FF];
+    unsigned char attr_byte = nametable[0x3C0 | ((vram_addr >> 4) & 0x38) | ((vram_addr >> 2) & 0x07)];
     unsigned char attr;
     if(((scrolled_x)/2) % 2 == 0 && (scrolled_y/16) % 2 == 0) // Upper left quad
         attr = attr_byte & 0x3;
@@ -328,56 +359,92 @@ void PPU::fetch_tile_data()
         attr = (attr_byte >> 4) & 0x3;
     else
         attr = (attr_byte >> 6) & 0x3;
-    attr_data.push(attr);
+    data.attr_data = attr;
 }
 
 PPU::PPU()
 {
+    PPUState &state = *this;
+    state = PPUState();
+    cpu = nullptr;
+    mapper = nullptr;
+    a12_watch = false;
+    buffer = nullptr;
+    std::fill(chr_pages, chr_pages+8, &unmapped_chr[0]);
+    chr_ram = nullptr;
+    cart_vram = nullptr;
+    map_nametables();
+    clear_chr_dirty();
+    hash_dirty = ~0ULL;
     vram_addr_high_byte = true;
     vram_addr = 0;
     addr_scroll_latch = false;
     fine_x = 0;
     scanline = -1;
-    attr_data = std::queue<unsigned char>();
-    tile_low_byte = std::queue<unsigned char>();
-    tile_high_byte = std::queue<unsigned char>();
-    nametable_byte = std::queue<unsigned char>();
+    dot = 0;
+    frame = 0;
+    skip_render = false;
+    std::fill(sprite_zero_pixels, sprite_zero_pixels+8, -1);
+    sprite_zero_on_line = false;
 }
 
 unsigned char PPU::read_memory(unsigned short address)
 {
     if(address >= 0x4000)
     {
-        std::cout << "BAD PPU READ" << std::endl;
+        NES_LOG(LOG_PPU, LOG_ERROR, "BAD PPU READ AT {x}", address);
+        log_flush();
         while(1);
     }
-    if(address <= 0xFFF)
-        return pattern_tables[0][address];
-    else if(address <= 0x1FFF)
-        return pattern_tables[1][address - 0x1000];
-    else if(address <= 0x2FFF)
-        return name_tables[get_nametable_address(address)-0x2000];
+    if(address <= 0x1FFF)
+        return chr_pages[address >> 10][address & 0x3FF];
     else if(address >= 0x3F00)
     {
-        if(address == 0x3F10 || address == 0x3F14 || address == 0x3F18 || address == 0x3F1C)
-            return palette[address - 0x3F10];
-        else
-            return palette[address - 0x3F00];
+        address &= 0x1F; // Palette RAM repeats up to $3FFF
+        if((address & 0x13) == 0x10) // $3F10/14/18/1C mirror the backdrop entries
+            address &= ~0x10;
+        return palette[address];
     }
     else
-        return 0;
+        return nametable_pages[(address >> 10) & 0x3][address & 0x3FF]; // $3000-$3EFF mirrors $2000
+}
+
+// Which 1kb of name_tables backs each of the four nametables
+static const unsigned char nametable_layout[5][4] =
+{
+    {0, 0, 1, 1}, // Horizontal
+    {0, 1, 0, 1}, // Vertical
+    {0, 0, 0, 0}, // Single screen, lower bank
+    {1, 1, 1, 1}, // Single screen, upper bank
+    {0, 1, 2, 3}, // Four screen, 2 and 3 are cart_vram
+};
+
+void PPU::set_mirroring(unsigned char mode)
+{
+    mirroring = mode;
+    map_nametables();
 }
 
-unsigned short PPU::get_nametable_address(unsigned short address)
+void PPU::map_nametables()
 {
-    switch(mirroring)
+    const unsigned char *layout = nametable_layout[mirroring <= MIRROR_FOUR_SCREEN ? mirroring : MIRROR_HORIZONTAL];
+    for(int i = 0; i < 4; i++)
     {
-        case 0: // Horizontal (vertical arrangement)
-            return address & ~0x400;
-        case 1:
-            return address & ~0x800;
+        if(layout[i] >= 2 && cart_vram)
+            nametable_pages[i] = &cart_vram[(layout[i] - 2) * 0x400];
+        else
+            nametable_pages[i] = &name_tables[(layout[i] & 0x1) * 0x400];
     }
-    return 0;
+}
+
+void PPU::mark_chr_dirty()
+{
+    std::fill(chr_dirty, chr_dirty + CHR_RAM_TILES / 64, ~0ULL);
+}
+
+void PPU::clear_chr_dirty()
+{
+    std::fill(chr_dirty, chr_dirty + CHR_RAM_TILES / 64, 0ULL);
 }
 
 void PPU::dump_memory(unsigned char *buffer)
@@ -390,23 +457,40 @@ void PPU::write_memory(unsigned short address, unsigned char val)
 {
     if(address >= 0x4000)
     {
-        std::cout << "BAD PPU WRITE" << std::endl;
+        NES_LOG(LOG_PPU, LOG_ERROR, "BAD PPU WRITE AT {x}", address);
+        log_flush();
         while(1);
     }
-    if(address <= 0xFFF)
-        pattern_tables[0][address] = val;
-    else if(address <= 0x1FFF)
-        pattern_tables[1][address - 0x1000] = val;
-    else if(address <= 0x2FFF)
-        name_tables[get_nametable_address(address)-0x2000] = val;
+    if(address <= 0x1FFF)
+    {
+        if(chr_ram)
+        {
+            unsigned char *byte = &chr_pages[address >> 10][address & 0x3FF];
+            if(*byte != val)
+            {
+                int tile = (byte - chr_ram) >> 4;
+                chr_dirty[tile >> 6] |= 1ULL << (tile & 63);
+                hash_dirty |= 1ULL << (16 + ((byte - chr_ram) >> 8));
+                *byte = val;
+            }
+        }
+    }
     else if(address >= 0x3F00)
     {
-        if(address == 0x3F10 || address == 0x3F14 || address == 0x3F18 || address == 0x3F1C)
-            palette[address - 0x3F10] = val;
+        address &= 0x1F;
+        if((address & 0x13) == 0x10)
+            address &= ~0x10;
+        palette[address] = val & 0x3F; // 6 bit entries, so palette_colors lookups stay in range
+    }
+    else
+    {
+        unsigned char *byte = &nametable_pages[(address >> 10) & 0x3][address & 0x3FF];
+        *byte = val;
+        if(byte >= name_tables && byte < name_tables + sizeof(name_tables))
+            hash_dirty |= 1ULL << ((byte - name_tables) >> 8);
         else
-            palette[address - 0x3F00] = val;
+            hash_dirty |= 1ULL << (8 + ((byte - cart_vram) >> 8));
     }
-
 }
 
 void PPU::write_ppuscroll(unsigned char val)
@@ -458,7 +542,7 @@ void PPU::increment_addr()
         vram_addr |= (vram_addr_temp & (1 << 9));
         vram_addr &= ~0x1F;
         vram_addr |= (vram_addr_temp & 0x1F);
-        std::cout << "[PPU] INC ADDR DURING RENDER" << std::endl;
+        NES_LOG(LOG_PPU, LOG_DEBUG, "INC ADDR DURING RENDER AT SCANLINE {} DOT {}", scanline, dot);
         if ((vram_addr & 0x7000) != 0x7000)        // if fine Y < 7
             vram_addr += 0x1000 ;                    // increment fine Y
         else
@@ -491,19 +575,21 @@ void PPU::update_addr(unsigned short byte)
 {
     if(!addr_scroll_latch)
     {
-       // std::cout << "[PPU] SETTING HIGH BYTE OF VRAM ADDR AS 0x" << std::hex << byte << std::dec << std::endl;
+        NES_LOG(LOG_PPU, LOG_TRACE, "SETTING HIGH BYTE OF VRAM ADDR AS {x}", byte);
         vram_addr_temp &= ~(0xFF00);
         vram_addr_temp |= (byte << 8) & 0xFf00;
         vram_addr_temp &= ~(1 << 15);
-     //   std::cout << "[PPU] TEMP VRAM IS 0x" << std::hex << vram_addr_temp << std::dec << std::endl;
+        NES_LOG(LOG_PPU, LOG_TRACE, "TEMP VRAM IS {x}", vram_addr_temp);
     }
     else
     {
-       // std::cout << "[PPU] SETTING LOW BYTE OF VRAM ADDR AS 0x" << std::hex << byte << std::dec << std::endl;
+        NES_LOG(LOG_PPU, LOG_TRACE, "SETTING LOW BYTE OF VRAM ADDR AS {x}", byte);
         vram_addr_temp &= ~0xFF;
         vram_addr_temp |= byte;
+        if(a12_watch && !(vram_addr & 0x1000) && (vram_addr_temp & 0x1000))
+            mapper->ppu_a12_rise(); // Some games clock scanline counters by hand through $2006
         vram_addr = vram_addr_temp;
-      //  std::cout << "[PPU] VRAM ADDR IS 0x" << std::hex << vram_addr << std::dec << std::endl;
+        NES_LOG(LOG_PPU, LOG_TRACE, "VRAM ADDR IS {x}", vram_addr);
     }
     addr_scroll_latch = !addr_scroll_latch;
 }
@@ -2,14 +2,32 @@
 #define PPU_H
 
 #include "cpu.h"
-#include <SFML/Graphics.hpp>
-#include<queue>
 
 class CPU;
+class Mapper;
 
-class PPU
+#define PPU_TILE_QUEUE_SIZE 8 // Power of two
+
+#define CHR_RAM_TILES 512 // 16 byte tiles in 8kb of CHR RAM
+
+#define MIRROR_HORIZONTAL 0
+#define MIRROR_VERTICAL 1
+#define MIRROR_SINGLE_LOWER 2
+#define MIRROR_SINGLE_UPPER 3
+#define MIRROR_FOUR_SCREEN 4
+
+struct TileData
+{
+    unsigned char nametable_byte;
+    unsigned char attr_data;
+    unsigned char tile_low_byte;
+    unsigned char tile_high_byte;
+};
+
+// Everything that makes up the PPU's emulated state, kept as plain data so a
+// snapshot is a single struct copy.
+struct PPUState
 {
-public:
     unsigned char PPUCTRL;
     unsigned char PPUMASK;
     unsigned char PPUSTATUS;
@@ -29,41 +47,57 @@ public:
     unsigned char OAM_secondary[8];
     unsigned char sprite_dots[256]; //index into palette
     int sprite_zero_pixels[8];
+    bool sprite_zero_on_line;
     bool bg_opaque[256];
-    unsigned char pattern_tables[2][4096];
-    unsigned char name_tables[4096];
+    unsigned char name_tables[0x800]; // The console's 2kb of VRAM
     unsigned char palette[32];
     unsigned char read_buffer;
     unsigned char fine_x;
     bool sprite_zero_pending;
-    std::queue<unsigned char> nametable_byte;
-    std::queue<unsigned char> attr_data;
-    std::queue<unsigned char> tile_low_byte;
-    std::queue<unsigned char> tile_high_byte;
+    TileData tile_queue[PPU_TILE_QUEUE_SIZE]; // Fetched tiles waiting to be shifted out
+    int tile_queue_head;
+    int tile_queue_size;
     unsigned char curr_nametable_byte;
     unsigned char curr_attr_data;
     unsigned char curr_tile_low_byte;
     unsigned char curr_tile_high_byte;
-    void fetch_tile_data();
     bool addr_scroll_latch;
+    int scanline;
+    int dot;
+    int frame;
+    bool odd_frame;
+    bool vram_addr_high_byte; // 0 = update low byte, 1 = update high byte
+};
+
+class PPU : public PPUState
+{
+public:
+    void fetch_tile_data();
     CPU *cpu;
+    Mapper *mapper;
+    bool a12_watch; // Mapper wants ppu_a12_rise() once per rendered scanline
+    unsigned char *chr_pages[8]; // $0000-$1FFF in 1kb pages, pointed into cartridge CHR by the mapper
+    unsigned char *nametable_pages[4]; // $2000-$2FFF in 1kb pages, pointed into name_tables by set_mirroring()
+    unsigned char *cart_vram; // 2kb of extra nametable RAM on four-screen boards, nullptr otherwise
+    unsigned char *chr_ram; // Base of cartridge CHR RAM, nullptr when CHR is ROM
+    unsigned long long chr_dirty[CHR_RAM_TILES / 64]; // Tiles of chr_ram changed since clear_chr_dirty(), bit (tile & 63) of word tile >> 6
+    void mark_chr_dirty();
+    unsigned long long hash_dirty; // 256 byte pages written since StateHasher last saw them: name_tables in bits 0-7, cart_vram in 8-15, chr_ram in 16-47
+    void clear_chr_dirty();
     void write_ppuscroll(unsigned char val);
     void do_cycle();
     unsigned char read_memory(unsigned short address);
     void write_memory(unsigned short address, unsigned char val);
     void render();
     unsigned char read_data();
-    unsigned short get_nametable_address(unsigned short address);
+    void set_mirroring(unsigned char mode);
+    void map_nametables(); // Rebuild nametable_pages from mirroring, e.g. after restoring state
     void write_data(unsigned char val);
     void write_oam(unsigned char val);
     void update_addr(unsigned short byte);
     void increment_addr();
-    int scanline;
-    int dot;
-    int frame;
-    bool odd_frame;
-    sf::Uint8 *buffer;
-    bool vram_addr_high_byte; // 0 = update low byte, 1 = update high byte
+    bool skip_render; // Keep timing exact but don't compose pixels into buffer
+    unsigned char *buffer; // 256x240 RGBA, owned by the frontend
     void dump_memory(unsigned char *buffer);
     PPU();
 };
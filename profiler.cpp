@@ -0,0 +1,117 @@
+#include<algorithm>
+#include<csignal>
+#include<cstdio>
+
+#include "profiler.h"
+
+static volatile std::sig_atomic_t report_requested = 0;
+
+static void request_report(int)
+{
+    report_requested = 1;
+}
+
+void install_profile_signal()
+{
+    std::signal(SIGUSR1, request_report);
+}
+
+bool profile_report_requested()
+{
+    if(!report_requested)
+        return false;
+    report_requested = 0;
+    return true;
+}
+
+Profiler::Profiler() : pc_counts(0x10000)
+{
+    clear();
+}
+
+void Profiler::clear()
+{
+    std::fill(pc_counts.begin(), pc_counts.end(), 0);
+    std::fill(opcode_counts, opcode_counts + 256, 0);
+    std::fill(dots, dots + DOTS_KINDS, 0);
+    std::fill(scope_ns, scope_ns + PROFILE_SCOPES, 0.0);
+    instructions = 0;
+    cycles = 0;
+    dma_cycles = 0;
+    ticks = 0;
+    frames = 0;
+    cpu_ns = 0;
+    ppu_ns = 0;
+    frame_ns = 0;
+    sampling = false;
+    in_dma = false;
+    pc = 0;
+}
+
+int Profiler::dot_kind(const PPU &ppu)
+{
+    if(ppu.scanline >= 240)
+        return DOTS_VBLANK;
+    if(!(ppu.PPUMASK & 0x18))
+        return DOTS_DISABLED;
+    if(ppu.dot == 0 || ppu.dot > 320)
+        return DOTS_TILE_PREFETCH;
+    if(ppu.dot > 256)
+        return DOTS_SPRITE_FETCH;
+    return ppu.scanline < 0 ? DOTS_PRE_RENDER : DOTS_VISIBLE;
+}
+
+static void print_top(std::ostream &out, const char *title, const unsigned long long *counts, int size, unsigned long long total, int limit, const char *format)
+{
+    std::vector<int> order;
+    for(int i = 0; i < size; i++)
+    {
+        if(counts[i])
+            order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [counts](int a, int b) { return counts[a] > counts[b]; });
+    out << title << " (" << order.size() << " distinct, top " << std::min<int>(limit, order.size()) << ")" << std::endl;
+    char line[80];
+    for(int i = 0; i < (int)order.size() && i < limit; i++)
+    {
+        char key[8];
+        std::snprintf(key, sizeof(key), format, order[i]);
+        std::snprintf(line, sizeof(line), "  %6s %14llu %6.2f%%", key, counts[order[i]], 100.0 * counts[order[i]] / std::max(total, 1ULL));
+        out << line << std::endl;
+    }
+}
+
+void Profiler::print_report(std::ostream &out)
+{
+    static const char *dot_names[DOTS_KINDS] = {"visible", "sprite fetch", "tile prefetch", "pre-render", "vblank", "rendering off"};
+    static const char *scope_names[PROFILE_SCOPES] = {"present", "dump I/O", "pacing"};
+    char line[96];
+    out << "PROFILE: " << frames << " frames, " << cycles << " CPU cycles, " << instructions << " instructions, "
+        << dma_cycles << " OAM DMA cycles (" << 100.0 * dma_cycles / std::max(cycles, 1ULL) << "%)" << std::endl;
+    // The CPU and PPU times are sampled, so scale them up to the whole run
+    double sampled = cpu_ns + ppu_ns;
+    double emulation_ms = frame_ns / 1e6;
+    out << "Host time (ms)" << std::endl;
+    std::snprintf(line, sizeof(line), "  %-14s %12.1f", "emulation", emulation_ms);
+    out << line << std::endl;
+    std::snprintf(line, sizeof(line), "  %-14s %12.1f %6.2f%% of emulation (sampled)", "  CPU", sampled ? emulation_ms * cpu_ns / sampled : 0, sampled ? 100 * cpu_ns / sampled : 0);
+    out << line << std::endl;
+    std::snprintf(line, sizeof(line), "  %-14s %12.1f %6.2f%% of emulation (sampled)", "  PPU", sampled ? emulation_ms * ppu_ns / sampled : 0, sampled ? 100 * ppu_ns / sampled : 0);
+    out << line << std::endl;
+    for(int i = 0; i < PROFILE_SCOPES; i++)
+    {
+        std::snprintf(line, sizeof(line), "  %-14s %12.1f", scope_names[i], scope_ns[i] / 1e6);
+        out << line << std::endl;
+    }
+    unsigned long long total_dots = 0;
+    for(int i = 0; i < DOTS_KINDS; i++)
+        total_dots += dots[i];
+    out << "PPU dots" << std::endl;
+    for(int i = 0; i < DOTS_KINDS; i++)
+    {
+        std::snprintf(line, sizeof(line), "  %-14s %14llu %6.2f%%", dot_names[i], dots[i], 100.0 * dots[i] / std::max(total_dots, 1ULL));
+        out << line << std::endl;
+    }
+    print_top(out, "Opcodes", opcode_counts, 256, instructions, 32, "$%02X");
+    print_top(out, "PCs", pc_counts.data(), 0x10000, instructions, 32, "$%04X");
+}
@@ -0,0 +1,147 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include<iostream>
+#include<chrono>
+#include<vector>
+
+#include "cpu.h"
+#include "ppu.h"
+
+// What the PPU was doing on a dot
+#define DOTS_VISIBLE 0 // Drawing a visible pixel
+#define DOTS_SPRITE_FETCH 1 // 257-320 of a rendered line
+#define DOTS_TILE_PREFETCH 2 // 0 and 321-340 of a rendered line
+#define DOTS_PRE_RENDER 3 // Line -1, dots 1-256
+#define DOTS_VBLANK 4 // Lines 240-260
+#define DOTS_DISABLED 5 // Rendered lines with rendering turned off
+#define DOTS_KINDS 6
+
+// Host time spent outside the emulation loop, measured by the frontend
+#define PROFILE_PRESENT 0 // Texture upload, draw and display
+#define PROFILE_DUMP_IO 1 // Per-frame debug files
+#define PROFILE_PACING 2 // Sleeping to the next frame deadline
+#define PROFILE_SCOPES 3
+
+// Console::step_frame calls these hooks around every CPU cycle and its
+// three PPU dots. NoProfiler's are empty, so the normal build compiles them
+// away entirely; build with NES_PROFILE (make PROFILE=1) to use Profiler,
+// which is also the only build that installs the SIGUSR1 report handler.
+class NoProfiler
+{
+public:
+    class Scope
+    {
+    };
+    void frame_begin() {}
+    void frame_end() {}
+    void ppu_begin(const PPU &) {}
+    void cpu_begin(const CPU &) {}
+    void cpu_end(const CPU &) {}
+    Scope scope(int) { return Scope(); }
+    void print_report(std::ostream &) {}
+};
+
+// Counts instructions per PC and per opcode, OAM DMA cycles and PPU dots by
+// kind, and times the CPU and PPU by sampling one loop iteration in
+// PROFILE_SAMPLE_EVERY, which keeps clock reads from swamping what they measure.
+#define PROFILE_SAMPLE_EVERY 64
+
+class Profiler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    class Scope
+    {
+    public:
+        Scope(Profiler *profiler, int which) : profiler(profiler), which(which), start(Clock::now()) {}
+        Scope(Scope &&other) : profiler(other.profiler), which(other.which), start(other.start) { other.profiler = nullptr; }
+        ~Scope()
+        {
+            if(profiler)
+                profiler->scope_ns[which] += std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        }
+    private:
+        Profiler *profiler;
+        int which;
+        Clock::time_point start;
+    };
+    Profiler();
+    void frame_begin()
+    {
+        frame_start = Clock::now();
+    }
+    void frame_end()
+    {
+        frames++;
+        frame_ns += std::chrono::duration<double, std::nano>(Clock::now() - frame_start).count();
+    }
+    void ppu_begin(const PPU &ppu)
+    {
+        sampling = ++ticks % PROFILE_SAMPLE_EVERY == 0;
+        if(sampling)
+            ppu_start = Clock::now();
+        dots[dot_kind(ppu)] += 3;
+    }
+    void cpu_begin(const CPU &cpu)
+    {
+        if(sampling)
+        {
+            cpu_start = Clock::now();
+            ppu_ns += std::chrono::duration<double, std::nano>(cpu_start - ppu_start).count();
+        }
+        pc = cpu.PC;
+        in_dma = cpu.oam_write_pending;
+    }
+    void cpu_end(const CPU &cpu)
+    {
+        if(sampling)
+            cpu_ns += std::chrono::duration<double, std::nano>(Clock::now() - cpu_start).count();
+        cycles++;
+        if(in_dma)
+            dma_cycles++;
+        else if(cpu.clocks_remain <= 0) // The instruction at pc just finished
+        {
+            pc_counts[pc]++;
+            opcode_counts[cpu.peek_memory(pc)]++;
+            instructions++;
+        }
+    }
+    Scope scope(int which)
+    {
+        return Scope(this, which);
+    }
+    void print_report(std::ostream &out);
+    void clear();
+private:
+    std::vector<unsigned long long> pc_counts;
+    unsigned long long opcode_counts[256];
+    unsigned long long dots[DOTS_KINDS];
+    unsigned long long instructions;
+    unsigned long long cycles;
+    unsigned long long dma_cycles;
+    unsigned long long ticks;
+    unsigned long long frames;
+    double cpu_ns;
+    double ppu_ns;
+    double frame_ns;
+    double scope_ns[PROFILE_SCOPES];
+    bool sampling;
+    bool in_dma;
+    unsigned short pc;
+    Clock::time_point ppu_start;
+    Clock::time_point cpu_start;
+    Clock::time_point frame_start;
+    static int dot_kind(const PPU &ppu);
+};
+
+#ifdef NES_PROFILE
+typedef Profiler FrameProfiler;
+#else
+typedef NoProfiler FrameProfiler;
+#endif
+
+// SIGUSR1 asks for a report; the frontend polls for it between frames
+void install_profile_signal();
+bool profile_report_requested();
+#endif
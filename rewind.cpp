@@ -0,0 +1,171 @@
+#include<cstring>
+
+#include "rewind.h"
+
+static unsigned char *put_varint(unsigned char *out, size_t value)
+{
+    while(value >= 0x80)
+    {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+static const unsigned char *get_varint(const unsigned char *in, size_t &value)
+{
+    value = 0;
+    int shift = 0;
+    while(*in & 0x80)
+    {
+        value |= (size_t)(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (size_t)(*in++) << shift;
+    return in;
+}
+
+// Encodes a ^ b as (zero run, literal length, literal bytes) tokens. Output is
+// never more than a few bytes longer than length.
+size_t rle_xor_encode(const unsigned char *a, const unsigned char *b, size_t length, unsigned char *out)
+{
+    unsigned char *start = out;
+    size_t i = 0;
+    while(i < length)
+    {
+        size_t zeros = 0;
+        while(i + zeros + 8 <= length)
+        {
+            unsigned long long wa, wb;
+            std::memcpy(&wa, a + i + zeros, 8);
+            std::memcpy(&wb, b + i + zeros, 8);
+            if(wa != wb)
+                break;
+            zeros += 8;
+        }
+        while(i + zeros < length && a[i + zeros] == b[i + zeros])
+            zeros++;
+        i += zeros;
+        // A literal ends at the first run of 4 unchanged bytes, shorter runs
+        // cost more as tokens than as literal zeros
+        size_t literal = 0;
+        while(i + literal < length)
+        {
+            size_t same = 0;
+            while(same < 4 && i + literal + same < length && a[i + literal + same] == b[i + literal + same])
+                same++;
+            if(same == 4 || i + literal + same == length)
+                break;
+            literal += same + 1;
+        }
+        out = put_varint(out, zeros);
+        out = put_varint(out, literal);
+        for(size_t j = 0; j < literal; j++)
+            *out++ = a[i + j] ^ b[i + j];
+        i += literal;
+    }
+    return out - start;
+}
+
+void rle_xor_apply(const unsigned char *in, size_t in_length, unsigned char *target)
+{
+    const unsigned char *end = in + in_length;
+    while(in < end)
+    {
+        size_t zeros, literal;
+        in = get_varint(in, zeros);
+        in = get_varint(in, literal);
+        target += zeros;
+        for(size_t j = 0; j < literal; j++)
+            *target++ ^= *in++;
+    }
+}
+
+RewindBuffer::RewindBuffer(size_t arena_size, int interval) : interval(interval), arena(arena_size)
+{
+    packed.resize(sizeof(SaveState) + 64);
+    last.reset(new SaveState());
+    current.reset(new SaveState());
+    clear();
+}
+
+void RewindBuffer::clear()
+{
+    entries.clear();
+    head = 0;
+    used = 0;
+    frames_since_capture = 0;
+    std::memset(last.get(), 0, sizeof(SaveState)); // The first capture is a delta against zeros
+}
+
+void RewindBuffer::evict_oldest()
+{
+    used -= entries.front().length;
+    entries.pop_front();
+}
+
+void RewindBuffer::capture(const Console &console)
+{
+    if(++frames_since_capture < interval)
+        return;
+    frames_since_capture = 0;
+    console.save_state(*current);
+    size_t length = rle_xor_encode((unsigned char *)current.get(), (unsigned char *)last.get(), sizeof(SaveState), packed.data());
+    if(length > arena.size())
+        return;
+    if(head + length > arena.size())
+    {
+        // Wrap. Whatever is left past the old head is older than anything
+        // at the start of the arena, so it goes first.
+        while(!entries.empty() && entries.front().offset >= head)
+            evict_oldest();
+        head = 0;
+    }
+    while(!entries.empty() && entries.front().offset < head + length && head < entries.front().offset + entries.front().length)
+        evict_oldest();
+    std::memcpy(&arena[head], packed.data(), length);
+    entries.push_back(Entry{head, length});
+    head += length;
+    used += length;
+    std::swap(last, current);
+}
+
+// Restores the newest capture and steps back so the next call restores the
+// one before it. The oldest capture's delta base has been evicted, so once
+// only it remains it is restored again rather than dropped.
+bool RewindBuffer::rewind(Console &console)
+{
+    if(entries.empty())
+        return false;
+    console.load_state(*last);
+    if(entries.size() > 1)
+    {
+        Entry &newest = entries.back();
+        rle_xor_apply(&arena[newest.offset], newest.length, (unsigned char *)last.get());
+        head = newest.offset;
+        used -= newest.length;
+        entries.pop_back();
+    }
+    frames_since_capture = 0;
+    return true;
+}
+
+size_t RewindBuffer::snapshots() const
+{
+    return entries.size();
+}
+
+size_t RewindBuffer::bytes_used() const
+{
+    return used;
+}
+
+void RewindBuffer::print_stats(std::ostream &out) const
+{
+    out << "[REWIND] " << entries.size() << " snapshots every " << interval << " frames, "
+        << used << " of " << arena.size() << " bytes";
+    if(!entries.empty())
+        out << ", " << used / entries.size() << " bytes/snapshot";
+    out << std::endl;
+}
@@ -0,0 +1,50 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include<vector>
+#include<deque>
+#include<memory>
+#include<iostream>
+
+#include "console.h"
+#include "savestate.h"
+
+#define REWIND_DEFAULT_ARENA (32 << 20)
+
+// Fixed-size ring of snapshots for rewinding. Each capture is stored as the
+// XOR against the previous capture, zero-run-length encoded. Frame to frame
+// almost nothing changes, so most captures shrink to a few hundred bytes.
+// Only the newest state is kept whole; rewinding walks the deltas backwards.
+class RewindBuffer
+{
+public:
+    RewindBuffer(size_t arena_size = REWIND_DEFAULT_ARENA, int interval = 1);
+    RewindBuffer(const RewindBuffer &) = delete;
+    RewindBuffer &operator=(const RewindBuffer &) = delete;
+    void capture(const Console &console); // Call once per frame, keeps every interval-th
+    bool rewind(Console &console);
+    void clear();
+    size_t snapshots() const;
+    size_t bytes_used() const;
+    void print_stats(std::ostream &out) const;
+    int interval;
+private:
+    struct Entry
+    {
+        size_t offset;
+        size_t length;
+    };
+    std::vector<unsigned char> arena;
+    std::deque<Entry> entries;
+    size_t head; // Next write offset into arena
+    size_t used;
+    std::vector<unsigned char> packed; // Scratch for the encoder
+    std::unique_ptr<SaveState> last; // Newest capture, whole
+    std::unique_ptr<SaveState> current;
+    int frames_since_capture;
+    void evict_oldest();
+};
+
+size_t rle_xor_encode(const unsigned char *a, const unsigned char *b, size_t length, unsigned char *out);
+void rle_xor_apply(const unsigned char *in, size_t in_length, unsigned char *target);
+#endif
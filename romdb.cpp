@@ -0,0 +1,136 @@
+#include<fstream>
+#include<sstream>
+#include<iostream>
+#include<cstring>
+
+#include "romdb.h"
+#include "nesfile.h"
+#include "ppu.h"
+
+bool RomDB::load(const std::string &path)
+{
+    std::ifstream in(path);
+    if(!in)
+        return false;
+    std::string line;
+    int line_number = 0;
+    while(std::getline(in, line))
+    {
+        line_number++;
+        RomDBEntry entry;
+        entry.crc = 0;
+        entry.has_sha1 = false;
+        entry.mapper = entry.submapper = entry.mirroring = entry.four_screen = -1;
+        entry.battery = entry.prg_ram_size = entry.region = -1;
+        size_t comment = line.find('#');
+        if(comment != std::string::npos)
+        {
+            size_t start = line.find_first_not_of(" \t", comment + 1);
+            if(start != std::string::npos)
+                entry.title = line.substr(start);
+            line = line.substr(0, comment);
+        }
+        std::istringstream fields(line);
+        std::string field;
+        bool have_crc = false;
+        bool ok = true;
+        while(fields >> field)
+        {
+            size_t eq = field.find('=');
+            std::string key = field.substr(0, eq);
+            std::string value = eq == std::string::npos ? "" : field.substr(eq + 1);
+            try
+            {
+                if(key == "crc32")
+                {
+                    entry.crc = std::stoul(value, nullptr, 16);
+                    have_crc = true;
+                }
+                else if(key == "sha1")
+                    ok = entry.has_sha1 = from_hex(value, entry.sha1, SHA1_SIZE);
+                else if(key == "mapper")
+                    entry.mapper = std::stoi(value);
+                else if(key == "submapper")
+                    entry.submapper = std::stoi(value);
+                else if(key == "mirroring")
+                {
+                    entry.four_screen = value == "4";
+                    if(value == "h")
+                        entry.mirroring = MIRROR_HORIZONTAL;
+                    else if(value == "v")
+                        entry.mirroring = MIRROR_VERTICAL;
+                    else if(value != "4")
+                        ok = false;
+                }
+                else if(key == "battery")
+                    entry.battery = std::stoi(value) != 0;
+                else if(key == "prgram")
+                    entry.prg_ram_size = std::stoi(value);
+                else if(key == "region")
+                {
+                    if(value == "ntsc")
+                        entry.region = REGION_NTSC;
+                    else if(value == "pal")
+                        entry.region = REGION_PAL;
+                    else if(value == "multi")
+                        entry.region = REGION_MULTI;
+                    else if(value == "dendy")
+                        entry.region = REGION_DENDY;
+                    else
+                        ok = false;
+                }
+                else
+                    ok = false;
+            }
+            catch(std::exception &)
+            {
+                ok = false;
+            }
+        }
+        if(!have_crc && ok && fields.str().find_first_not_of(" \t\r") == std::string::npos)
+            continue; // Blank or comment-only line
+        if(!have_crc || !ok)
+        {
+            std::cout << "BAD ROM DB LINE " << path << ":" << line_number << std::endl;
+            continue;
+        }
+        entries.emplace(entry.crc, entry);
+    }
+    return true;
+}
+
+const RomDBEntry *RomDB::find(const NESFile &rom) const
+{
+    auto range = entries.equal_range(rom.crc);
+    if(range.first == range.second)
+        return nullptr;
+    unsigned char digest[SHA1_SIZE];
+    bool have_digest = false;
+    for(auto it = range.first; it != range.second; ++it)
+    {
+        if(!it->second.has_sha1)
+            return &it->second;
+        if(!have_digest)
+        {
+            rom.sha1(digest);
+            have_digest = true;
+        }
+        if(std::memcmp(digest, it->second.sha1, SHA1_SIZE) == 0)
+            return &it->second;
+    }
+    return nullptr;
+}
+
+bool RomDB::apply(NESFile &rom) const
+{
+    const RomDBEntry *entry = find(rom);
+    if(!entry)
+        return false;
+    rom.apply_fix(*entry);
+    return true;
+}
+
+size_t RomDB::size() const
+{
+    return entries.size();
+}
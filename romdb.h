@@ -0,0 +1,46 @@
+#ifndef ROMDB_H
+#define ROMDB_H
+
+#include<string>
+#include<vector>
+#include<unordered_map>
+
+#include "hash.h"
+
+class NESFile;
+
+// Corrections for a ROM whose header is known to be wrong. Fields left at -1
+// keep whatever the header says.
+struct RomDBEntry
+{
+    unsigned int crc;
+    unsigned char sha1[SHA1_SIZE];
+    bool has_sha1;
+    int mapper;
+    int submapper;
+    int mirroring;
+    int four_screen;
+    int battery;
+    int prg_ram_size;
+    int region;
+    std::string title;
+};
+
+// Header fix database, keyed by CRC32 of PRG + CHR. One entry per line:
+//
+//   crc32=1a2b3c4d [sha1=<40 hex>] [mapper=N] [submapper=N]
+//       [mirroring=h|v|4] [battery=0|1] [prgram=BYTES]
+//       [region=ntsc|pal|multi|dendy] [# title]
+//
+// When an entry has a SHA-1 it must match too, to rule out CRC collisions.
+class RomDB
+{
+public:
+    bool load(const std::string &path);
+    const RomDBEntry *find(const NESFile &rom) const;
+    bool apply(NESFile &rom) const;
+    size_t size() const;
+private:
+    std::unordered_multimap<unsigned int, RomDBEntry> entries;
+};
+#endif
@@ -0,0 +1,139 @@
+#include<fstream>
+#include<cstring>
+#include<cstdio>
+#include<algorithm>
+
+#include "romindex.h"
+#include "ppu.h"
+
+RomIndexRecord make_index_record(const NESFile &rom)
+{
+    RomIndexRecord record;
+    std::memset(&record, 0, sizeof(record));
+    record.crc = rom.crc;
+    rom.sha1(record.sha1);
+    record.prg_rom_size = rom.prg_rom_size;
+    record.chr_rom_size = rom.chr_rom_size;
+    record.prg_ram_size = rom.prg_ram_size + rom.prg_nvram_size;
+    record.mapper = rom.mapper;
+    record.submapper = rom.submapper;
+    record.mirroring = rom.four_screen ? MIRROR_FOUR_SCREEN : rom.mirroring;
+    record.region = rom.region;
+    record.flags = (rom.battery ? ROMINDEX_BATTERY : 0) | (rom.nes2 ? ROMINDEX_NES2 : 0)
+        | (rom.trainer ? ROMINDEX_TRAINER : 0) | (rom.db_fixed ? ROMINDEX_DB_FIXED : 0);
+    return record;
+}
+
+void RomIndex::add(RomIndexRecord record, const std::string &rom_path)
+{
+    record.path_offset = strings.size();
+    record.path_length = rom_path.size();
+    strings += rom_path;
+    records.push_back(record);
+}
+
+// Orders by CRC32, then SHA-1, then path, so the same library always gives
+// the same index however the scan was split up.
+void RomIndex::sort()
+{
+    std::sort(records.begin(), records.end(), [this](const RomIndexRecord &a, const RomIndexRecord &b)
+    {
+        if(a.crc != b.crc)
+            return a.crc < b.crc;
+        int cmp = std::memcmp(a.sha1, b.sha1, SHA1_SIZE);
+        if(cmp != 0)
+            return cmp < 0;
+        return strings.compare(a.path_offset, a.path_length, strings, b.path_offset, b.path_length) < 0;
+    });
+}
+
+std::string RomIndex::path(const RomIndexRecord &record) const
+{
+    return strings.substr(record.path_offset, record.path_length);
+}
+
+const RomIndexRecord *RomIndex::find(unsigned int crc) const
+{
+    auto found = std::lower_bound(records.begin(), records.end(), crc, [](const RomIndexRecord &record, unsigned int key)
+    {
+        return record.crc < key;
+    });
+    if(found == records.end() || found->crc != crc)
+        return nullptr;
+    return &*found;
+}
+
+bool RomIndex::write(const std::string &index_path) const
+{
+    std::ofstream out(index_path, std::ios::out | std::ios::binary);
+    if(!out)
+        return false;
+    RomIndexHeader header;
+    std::memcpy(header.magic, ROMINDEX_MAGIC, 4);
+    header.version = ROMINDEX_VERSION;
+    header.count = records.size();
+    header.strings_size = strings.size();
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)records.data(), records.size() * sizeof(RomIndexRecord));
+    out.write(strings.data(), strings.size());
+    return (bool)out;
+}
+
+bool RomIndex::read(const std::string &index_path)
+{
+    std::ifstream in(index_path, std::ios::in | std::ios::binary);
+    RomIndexHeader header;
+    if(!in.read((char *)&header, sizeof(header)))
+        return false;
+    if(std::memcmp(header.magic, ROMINDEX_MAGIC, 4) != 0 || header.version != ROMINDEX_VERSION)
+        return false;
+    records.resize(header.count);
+    strings.resize(header.strings_size);
+    in.read((char *)records.data(), records.size() * sizeof(RomIndexRecord));
+    in.read(&strings[0], strings.size());
+    if(!in)
+    {
+        records.clear();
+        strings.clear();
+        return false;
+    }
+    for(const RomIndexRecord &record : records)
+    {
+        if((size_t)record.path_offset + record.path_length > strings.size())
+        {
+            records.clear();
+            strings.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RomIndex::write_csv(const std::string &csv_path) const
+{
+    static const char *mirrorings[] = {"horizontal", "vertical", "single-lower", "single-upper", "four-screen"};
+    static const char *regions[] = {"NTSC", "PAL", "multi", "Dendy"};
+    std::ofstream out(csv_path, std::ios::out);
+    if(!out)
+        return false;
+    out << "crc32,sha1,mapper,submapper,mirroring,region,prg_rom,chr_rom,prg_ram,battery,nes2,path\n";
+    char crc[9];
+    for(const RomIndexRecord &record : records)
+    {
+        std::snprintf(crc, sizeof(crc), "%08x", record.crc);
+        std::string rom_path = path(record);
+        std::string quoted;
+        for(char c : rom_path)
+        {
+            if(c == '"')
+                quoted += '"';
+            quoted += c;
+        }
+        out << crc << ',' << to_hex(record.sha1, SHA1_SIZE) << ',' << record.mapper << ',' << (int)record.submapper
+            << ',' << mirrorings[record.mirroring % 5] << ',' << regions[record.region & 0x3]
+            << ',' << record.prg_rom_size << ',' << record.chr_rom_size << ',' << record.prg_ram_size
+            << ',' << ((record.flags & ROMINDEX_BATTERY) ? 1 : 0) << ',' << ((record.flags & ROMINDEX_NES2) ? 1 : 0)
+            << ",\"" << quoted << "\"\n";
+    }
+    return (bool)out;
+}
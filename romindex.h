@@ -0,0 +1,61 @@
+#ifndef ROMINDEX_H
+#define ROMINDEX_H
+
+#include<string>
+#include<vector>
+
+#include "hash.h"
+#include "nesfile.h"
+
+#define ROMINDEX_MAGIC "NESI"
+#define ROMINDEX_VERSION 1
+
+// Bits of RomIndexRecord::flags
+#define ROMINDEX_BATTERY 0x01
+#define ROMINDEX_NES2 0x02
+#define ROMINDEX_TRAINER 0x04
+#define ROMINDEX_DB_FIXED 0x08
+
+// One ROM in an index. Records are fixed size and sorted by CRC32 then SHA-1
+// so an index can be read in one go and searched in place; paths live in a
+// string table after the records.
+struct RomIndexRecord
+{
+    unsigned int crc;
+    unsigned char sha1[SHA1_SIZE]; // Of PRG + CHR, like crc
+    unsigned int prg_rom_size;
+    unsigned int chr_rom_size; // 0 for CHR RAM boards
+    unsigned int prg_ram_size; // Volatile and battery-backed together
+    unsigned int path_offset;
+    unsigned int path_length;
+    unsigned short mapper;
+    unsigned char submapper;
+    unsigned char mirroring; // MIRROR_*, MIRROR_FOUR_SCREEN for four-screen boards
+    unsigned char region;
+    unsigned char flags;
+};
+
+struct RomIndexHeader
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int count;
+    unsigned int strings_size;
+};
+
+RomIndexRecord make_index_record(const NESFile &rom);
+
+class RomIndex
+{
+public:
+    std::vector<RomIndexRecord> records;
+    std::string strings;
+    void add(RomIndexRecord record, const std::string &path);
+    void sort();
+    std::string path(const RomIndexRecord &record) const;
+    const RomIndexRecord *find(unsigned int crc) const; // First record with this CRC32, nullptr if none
+    bool write(const std::string &path) const;
+    bool read(const std::string &path);
+    bool write_csv(const std::string &path) const;
+};
+#endif
@@ -0,0 +1,65 @@
+#include<cstring>
+#include<fstream>
+#include<cstddef>
+
+#include "savestate.h"
+
+void init_state_header(SaveState &state)
+{
+    std::memcpy(state.magic, SAVESTATE_MAGIC, 4);
+    state.version = SAVESTATE_VERSION;
+    state.cpu_size = sizeof(CPUState);
+    state.ppu_size = sizeof(PPUState);
+}
+
+bool check_state_header(const SaveState &state)
+{
+    return std::memcmp(state.magic, SAVESTATE_MAGIC, 4) == 0
+        && state.version == SAVESTATE_VERSION
+        && state.cpu_size == sizeof(CPUState)
+        && state.ppu_size == sizeof(PPUState);
+}
+
+#define CPU_FIELD(f) {"cpu." #f, offsetof(SaveState, cpu) + offsetof(CPUState, f), sizeof(CPUState::f)}
+#define PPU_FIELD(f) {"ppu." #f, offsetof(SaveState, ppu) + offsetof(PPUState, f), sizeof(PPUState::f)}
+
+const StateField state_fields[] =
+{
+    CPU_FIELD(A), CPU_FIELD(X), CPU_FIELD(Y), CPU_FIELD(S), CPU_FIELD(PC), CPU_FIELD(IRQ), CPU_FIELD(NMI),
+    CPU_FIELD(oam_write_pending), CPU_FIELD(flags_carry), CPU_FIELD(flags_zero), CPU_FIELD(flags_int_disable),
+    CPU_FIELD(flags_dec_mode), CPU_FIELD(flags_break), CPU_FIELD(flags_overflow), CPU_FIELD(flags_negative),
+    CPU_FIELD(ram), CPU_FIELD(cycle), CPU_FIELD(clocks_remain), CPU_FIELD(controller_read_count),
+    CPU_FIELD(controller_strobe), CPU_FIELD(buttons_pressed),
+    PPU_FIELD(PPUCTRL), PPU_FIELD(PPUMASK), PPU_FIELD(PPUSTATUS), PPU_FIELD(OAMADDR), PPU_FIELD(OAMDATA),
+    PPU_FIELD(PPUSCROLL), PPU_FIELD(PPUADDR), PPU_FIELD(PPUDATA), PPU_FIELD(OAMDMA), PPU_FIELD(vram_addr),
+    PPU_FIELD(vram_addr_temp), PPU_FIELD(vblank), PPU_FIELD(NMI_occurred), PPU_FIELD(NMI_output),
+    PPU_FIELD(mirroring), PPU_FIELD(OAM), PPU_FIELD(sprite_zero_pixels), PPU_FIELD(sprite_zero_on_line),
+    PPU_FIELD(name_tables), PPU_FIELD(palette), PPU_FIELD(read_buffer), PPU_FIELD(fine_x),
+    PPU_FIELD(sprite_zero_pending), PPU_FIELD(addr_scroll_latch), PPU_FIELD(scanline), PPU_FIELD(dot),
+    PPU_FIELD(frame), PPU_FIELD(odd_frame), PPU_FIELD(vram_addr_high_byte),
+    {"mapper", offsetof(SaveState, mapper), MAPPER_STATE_SIZE},
+    {"chr_ram", offsetof(SaveState, chr_ram), MAPPER_CHR_RAM_SIZE},
+    {"prg_ram", offsetof(SaveState, prg_ram), MAPPER_PRG_RAM_SIZE},
+    {"vram", offsetof(SaveState, vram), MAPPER_VRAM_SIZE},
+};
+
+const int state_field_count = sizeof(state_fields) / sizeof(state_fields[0]);
+
+bool write_state_file(const std::string &path, const SaveState &state)
+{
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    out.write((const char *)&state, sizeof(SaveState));
+    return out.good();
+}
+
+bool read_state_file(const std::string &path, SaveState &state)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    in.read((char *)&state, sizeof(SaveState));
+    if(!in.good() || !check_state_header(state))
+    {
+        std::cout << "BAD STATE FILE " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include<string>
+#include<type_traits>
+#include<cstddef>
+
+#include "cpu.h"
+#include "ppu.h"
+#include "mapper.h"
+
+#define SAVESTATE_MAGIC "NESS"
+#define SAVESTATE_VERSION 5 // Bump whenever anything below changes layout
+
+// A full machine snapshot. The header lets a state file written by another
+// build be rejected instead of loaded into mismatched structs, and the
+// cartridge fields one written for another game.
+struct SaveState
+{
+    char magic[4];
+    unsigned int version;
+    unsigned int cpu_size;
+    unsigned int ppu_size;
+    unsigned int rom_crc; // NESFile::crc of the cartridge it was saved from
+    int rom_mapper;
+    CPUState cpu;
+    PPUState ppu;
+    unsigned char mapper[MAPPER_STATE_SIZE];
+    unsigned char chr_ram[MAPPER_CHR_RAM_SIZE];
+    unsigned char prg_ram[MAPPER_PRG_RAM_SIZE];
+    unsigned char vram[MAPPER_VRAM_SIZE];
+};
+
+static_assert(std::is_trivially_copyable<CPUState>::value, "CPUState must stay plain data");
+static_assert(std::is_trivially_copyable<PPUState>::value, "PPUState must stay plain data");
+
+// One piece of a SaveState that decides how emulation goes on from there.
+// state_fields lists all of them and nothing else: the PPU's render-only
+// scratch (sprite_dots, bg_opaque, the tile queue, OAM_secondary, the
+// curr_* bytes) is rebuilt while rendering and left stale when rendering is
+// skipped, so two runs that only differ in which frames they showed compare
+// equal. The sprite 0 fields are in: they're evaluated the same way with
+// rendering skipped, and decide when sprite 0 hit fires on the next line.
+// Padding is never part of a field.
+struct StateField
+{
+    const char *name;
+    size_t offset; // Into SaveState
+    size_t size;
+};
+
+extern const StateField state_fields[];
+extern const int state_field_count;
+
+void init_state_header(SaveState &state);
+bool check_state_header(const SaveState &state);
+bool write_state_file(const std::string &path, const SaveState &state);
+bool read_state_file(const std::string &path, SaveState &state);
+#endif
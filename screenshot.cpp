@@ -0,0 +1,140 @@
+#include<fstream>
+#include<vector>
+#include<string>
+#include<algorithm>
+
+#include "screenshot.h"
+
+bool write_ppm(const std::string &path, const unsigned char *rgba, int width, int height)
+{
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    if(!out)
+        return false;
+    out << "P6\n" << width << " " << height << "\n255\n";
+    std::vector<unsigned char> rgb(width * height * 3);
+    for(int i = 0; i < width * height; i++)
+    {
+        rgb[i*3] = rgba[i*4];
+        rgb[i*3 + 1] = rgba[i*4 + 1];
+        rgb[i*3 + 2] = rgba[i*4 + 2];
+    }
+    out.write((const char *)rgb.data(), rgb.size());
+    return (bool)out;
+}
+
+bool read_ppm(const std::string &path, unsigned char *rgba, int width, int height)
+{
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    std::string magic;
+    int file_width = 0, file_height = 0, max_value = 0;
+    in >> magic >> file_width >> file_height >> max_value;
+    in.get();
+    if(!in || magic != "P6" || file_width != width || file_height != height || max_value != 255)
+        return false;
+    std::vector<unsigned char> rgb(width * height * 3);
+    in.read((char *)rgb.data(), rgb.size());
+    if(!in)
+        return false;
+    for(int i = 0; i < width * height; i++)
+    {
+        rgba[i*4] = rgb[i*3];
+        rgba[i*4 + 1] = rgb[i*3 + 1];
+        rgba[i*4 + 2] = rgb[i*3 + 2];
+        rgba[i*4 + 3] = 255;
+    }
+    return true;
+}
+
+struct CRCTable
+{
+    unsigned int entries[256];
+    CRCTable()
+    {
+        for(unsigned int n = 0; n < 256; n++)
+        {
+            unsigned int c = n;
+            for(int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+    }
+};
+
+static unsigned int png_crc(const unsigned char *data, size_t length)
+{
+    static const CRCTable table; // Built once, safely even from several workers
+    unsigned int crc = ~0u;
+    for(size_t i = 0; i < length; i++)
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put_be32(std::vector<unsigned char> &out, unsigned int value)
+{
+    out.push_back(value >> 24);
+    out.push_back(value >> 16);
+    out.push_back(value >> 8);
+    out.push_back(value);
+}
+
+static void write_chunk(std::ofstream &out, const char *type, const std::vector<unsigned char> &data)
+{
+    std::vector<unsigned char> chunk;
+    put_be32(chunk, data.size());
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), data.begin(), data.end());
+    put_be32(chunk, png_crc(chunk.data() + 4, chunk.size() - 4));
+    out.write((const char *)chunk.data(), chunk.size());
+}
+
+bool write_png(const std::string &path, const unsigned char *rgba, int width, int height)
+{
+    std::ofstream out(path, std::ios::out | std::ios::binary);
+    if(!out)
+        return false;
+    out.write("\x89PNG\r\n\x1a\n", 8);
+    std::vector<unsigned char> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    header.push_back(8); // Bit depth
+    header.push_back(2); // RGB
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    write_chunk(out, "IHDR", header);
+
+    // Each row is a filter type byte (0, none) and the row's pixels
+    std::vector<unsigned char> raw;
+    raw.reserve(height * (1 + width * 3));
+    for(int y = 0; y < height; y++)
+    {
+        raw.push_back(0);
+        for(int x = 0; x < width; x++)
+        {
+            const unsigned char *pixel = rgba + (y * width + x) * 4;
+            raw.insert(raw.end(), pixel, pixel + 3);
+        }
+    }
+    std::vector<unsigned char> zlib = {0x78, 0x01};
+    for(size_t at = 0; at < raw.size(); )
+    {
+        size_t length = std::min<size_t>(raw.size() - at, 0xFFFF);
+        zlib.push_back(at + length == raw.size()); // BFINAL, BTYPE 00 (stored)
+        zlib.push_back(length & 0xFF);
+        zlib.push_back(length >> 8);
+        zlib.push_back(~length & 0xFF);
+        zlib.push_back((~length >> 8) & 0xFF);
+        zlib.insert(zlib.end(), raw.begin() + at, raw.begin() + at + length);
+        at += length;
+    }
+    unsigned int a = 1, b = 0; // Adler-32 of the uncompressed data
+    for(unsigned char c : raw)
+    {
+        a = (a + c) % 65521;
+        b = (b + a) % 65521;
+    }
+    put_be32(zlib, (b << 16) | a);
+    write_chunk(out, "IDAT", zlib);
+    write_chunk(out, "IEND", std::vector<unsigned char>());
+    return (bool)out;
+}
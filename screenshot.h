@@ -0,0 +1,16 @@
+#ifndef SCREENSHOT_H
+#define SCREENSHOT_H
+
+#include<string>
+
+#define SCREEN_WIDTH 256
+#define SCREEN_HEIGHT 240
+
+// Writes a PPU::buffer style RGBA image as a binary PPM, dropping alpha.
+bool write_ppm(const std::string &path, const unsigned char *rgba, int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT);
+// Reads a binary PPM of the given size back into RGBA, alpha set to 255
+bool read_ppm(const std::string &path, unsigned char *rgba, int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT);
+// Writes RGBA as an 8 bit RGB PNG. The pixel data goes in stored (not
+// compressed) deflate blocks, so no zlib is needed and any viewer opens it.
+bool write_png(const std::string &path, const unsigned char *rgba, int width = SCREEN_WIDTH, int height = SCREEN_HEIGHT);
+#endif
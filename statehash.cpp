@@ -0,0 +1,130 @@
+#include<cstddef>
+#include<cstdio>
+#include<cstring>
+#include<algorithm>
+
+#include "statehash.h"
+#include "hash.h"
+
+StateHasher::StateHasher()
+{
+    cpu_registers = 0;
+    ppu_registers = 0;
+    mapper_registers = 0;
+    std::fill(ram, ram + STATE_HASH_RAM_PAGES, 0);
+    std::fill(prg_ram, prg_ram + STATE_HASH_PRG_RAM_PAGES, 0);
+    std::fill(vram, vram + STATE_HASH_VRAM_PAGES, 0);
+    std::fill(chr_ram, chr_ram + STATE_HASH_CHR_RAM_PAGES, 0);
+    std::fill(cart_vram, cart_vram + STATE_HASH_CART_VRAM_PAGES, 0);
+}
+
+// Hashes the state_fields that live in the SaveState struct at base, read
+// from object (a live CPU/PPU or that part of a SaveState), except the
+// memory at skip (hashed in pages)
+static unsigned long long hash_fields(const void *object, size_t base, size_t size, size_t skip)
+{
+    unsigned long long hash = 0;
+    for(int i = 0; i < state_field_count; i++)
+    {
+        const StateField &field = state_fields[i];
+        if(field.offset < base || field.offset >= base + size || field.offset == skip)
+            continue;
+        hash = xxh64((const unsigned char *)object + (field.offset - base), field.size, hash);
+    }
+    return hash;
+}
+
+static const unsigned char zero_page[STATE_HASH_PAGE] = {};
+
+// Rehashes the pages of memory whose bits (starting at first_bit) are set
+// in dirty. A missing memory hashes as zero pages, the way a SaveState
+// stores it.
+static void hash_pages(unsigned long long *hashes, int pages, const unsigned char *memory, unsigned long long dirty, int first_bit)
+{
+    for(int i = 0; i < pages; i++)
+    {
+        if((dirty >> (first_bit + i)) & 1)
+            hashes[i] = xxh64(memory ? memory + i * STATE_HASH_PAGE : zero_page, STATE_HASH_PAGE);
+    }
+}
+
+unsigned long long StateHasher::update(Console &console)
+{
+    CPU &cpu = console.cpu;
+    PPU &ppu = console.ppu;
+    // Registers change every frame, so they're always rehashed
+    cpu_registers = hash_fields(&cpu, offsetof(SaveState, cpu), sizeof(CPUState), offsetof(SaveState, cpu) + offsetof(CPUState, ram));
+    ppu_registers = hash_fields(&ppu, offsetof(SaveState, ppu), sizeof(PPUState), offsetof(SaveState, ppu) + offsetof(PPUState, name_tables));
+    Mapper *mapper = console.mapper.get();
+    unsigned char mapper_state[MAPPER_STATE_SIZE] = {}; // Zero padded like SaveState::mapper
+    if(mapper)
+        std::memcpy(mapper_state, mapper->state_data(), mapper->state_size());
+    mapper_registers = xxh64(mapper_state, MAPPER_STATE_SIZE);
+    hash_pages(ram, STATE_HASH_RAM_PAGES, cpu.ram, cpu.hash_dirty, 0);
+    hash_pages(prg_ram, STATE_HASH_PRG_RAM_PAGES, mapper ? mapper->prg_ram() : nullptr, cpu.hash_dirty, 8);
+    hash_pages(vram, STATE_HASH_VRAM_PAGES, ppu.name_tables, ppu.hash_dirty, 0);
+    hash_pages(chr_ram, STATE_HASH_CHR_RAM_PAGES, mapper ? mapper->chr_ram() : nullptr, ppu.hash_dirty, 16);
+    hash_pages(cart_vram, STATE_HASH_CART_VRAM_PAGES, mapper ? mapper->vram() : nullptr, ppu.hash_dirty, 8);
+    cpu.hash_dirty = 0;
+    ppu.hash_dirty = 0;
+    return combine();
+}
+
+unsigned long long StateHasher::update(const SaveState &state)
+{
+    cpu_registers = hash_fields(&state.cpu, offsetof(SaveState, cpu), sizeof(CPUState), offsetof(SaveState, cpu) + offsetof(CPUState, ram));
+    ppu_registers = hash_fields(&state.ppu, offsetof(SaveState, ppu), sizeof(PPUState), offsetof(SaveState, ppu) + offsetof(PPUState, name_tables));
+    mapper_registers = xxh64(state.mapper, MAPPER_STATE_SIZE);
+    hash_pages(ram, STATE_HASH_RAM_PAGES, state.cpu.ram, ~0ULL, 0);
+    hash_pages(prg_ram, STATE_HASH_PRG_RAM_PAGES, state.prg_ram, ~0ULL, 0);
+    hash_pages(vram, STATE_HASH_VRAM_PAGES, state.ppu.name_tables, ~0ULL, 0);
+    hash_pages(chr_ram, STATE_HASH_CHR_RAM_PAGES, state.chr_ram, ~0ULL, 0);
+    hash_pages(cart_vram, STATE_HASH_CART_VRAM_PAGES, state.vram, ~0ULL, 0);
+    return combine();
+}
+
+unsigned long long StateHasher::combine()
+{
+    unsigned long long registers[3] = {cpu_registers, ppu_registers, mapper_registers};
+    unsigned long long hash = xxh64(registers, sizeof(registers));
+    hash = xxh64(ram, sizeof(ram), hash);
+    hash = xxh64(prg_ram, sizeof(prg_ram), hash);
+    hash = xxh64(vram, sizeof(vram), hash);
+    hash = xxh64(chr_ram, sizeof(chr_ram), hash);
+    return xxh64(cart_vram, sizeof(cart_vram), hash);
+}
+
+unsigned long long hash_state(const SaveState &state)
+{
+    StateHasher hasher;
+    return hasher.update(state);
+}
+
+HashLog::HashLog()
+{
+    every = 1;
+}
+
+bool HashLog::open(const std::string &path, int every)
+{
+    out.open(path, std::ios::out | std::ios::trunc);
+    this->every = every < 1 ? 1 : every;
+    return out.good();
+}
+
+bool HashLog::is_open()
+{
+    return out.is_open();
+}
+
+void HashLog::frame_done(Console &console)
+{
+    if(!out.is_open())
+        return;
+    if(console.ppu.frame % every)
+        return; // Dirty bits keep accumulating, the next update catches up
+    unsigned long long hash = hasher.update(console);
+    char line[40];
+    std::snprintf(line, sizeof(line), "%d %016llx\n", console.ppu.frame, hash);
+    out << line;
+}
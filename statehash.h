@@ -0,0 +1,65 @@
+#ifndef STATEHASH_H
+#define STATEHASH_H
+
+#include<string>
+#include<fstream>
+
+#include "console.h"
+
+#define STATE_HASH_PAGE 0x100
+#define STATE_HASH_RAM_PAGES (CPU_RAM_SIZE / STATE_HASH_PAGE)
+#define STATE_HASH_PRG_RAM_PAGES (MAPPER_PRG_RAM_SIZE / STATE_HASH_PAGE)
+#define STATE_HASH_VRAM_PAGES (0x800 / STATE_HASH_PAGE)
+#define STATE_HASH_CHR_RAM_PAGES (MAPPER_CHR_RAM_SIZE / STATE_HASH_PAGE)
+#define STATE_HASH_CART_VRAM_PAGES (MAPPER_VRAM_SIZE / STATE_HASH_PAGE)
+
+// A 64 bit fingerprint of a running console's architectural state (the
+// state_fields of savestate.h), so it doesn't depend on which frames were
+// rendered. Memory is hashed in 256 byte pages and update() only rehashes
+// the pages the CPU and PPU marked in their hash_dirty bits since the last
+// call, so hashing every frame costs a few kilobytes of XXH64 at most. The
+// result doesn't depend on how often update() runs.
+//
+// The hash_dirty bits are cleared by update(), so use one StateHasher per
+// console; the PPU's chr_dirty tiles are left to their own consumers.
+// Memory changed behind the emulator's back (not through CPU/PPU writes,
+// load_cartridge or load_state) isn't noticed. update(SaveState) rehashes
+// everything from a snapshot and gives the same value update(Console)
+// would for a console in that state.
+class StateHasher
+{
+public:
+    StateHasher();
+    unsigned long long update(Console &console);
+    unsigned long long update(const SaveState &state);
+private:
+    unsigned long long combine();
+    unsigned long long cpu_registers;
+    unsigned long long ppu_registers;
+    unsigned long long mapper_registers;
+    unsigned long long ram[STATE_HASH_RAM_PAGES];
+    unsigned long long prg_ram[STATE_HASH_PRG_RAM_PAGES];
+    unsigned long long vram[STATE_HASH_VRAM_PAGES];
+    unsigned long long chr_ram[STATE_HASH_CHR_RAM_PAGES];
+    unsigned long long cart_vram[STATE_HASH_CART_VRAM_PAGES];
+};
+
+// One-off StateHasher hash of a snapshot, as printed by batch and difftest
+// and comparable with HashLog lines and bench's hash
+unsigned long long hash_state(const SaveState &state);
+
+// Writes "frame hash" lines for every Nth frame, for diffing runs of
+// different builds or machines against each other
+class HashLog
+{
+public:
+    HashLog();
+    bool open(const std::string &path, int every = 1);
+    void frame_done(Console &console); // Call after each emulated frame
+    bool is_open();
+private:
+    std::ofstream out;
+    StateHasher hasher;
+    int every;
+};
+#endif
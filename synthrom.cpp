@@ -0,0 +1,181 @@
+#include<initializer_list>
+#include<algorithm>
+
+#include "synthrom.h"
+
+#define SYNTH_PRG_SIZE 0x4000 // One 16kb bank, mirrored at $C000
+#define SYNTH_CHR_SIZE 0x2000
+
+// Just enough of an assembler to lay out hand-encoded 6502
+class Assembler
+{
+public:
+    std::vector<unsigned char> prg;
+    Assembler() : prg(SYNTH_PRG_SIZE, 0xEA) {}
+    unsigned short here()
+    {
+        return 0x8000 + size;
+    }
+    void emit(std::initializer_list<int> bytes)
+    {
+        for(int byte : bytes)
+            prg[size++] = byte;
+    }
+    void branch(int opcode, unsigned short target)
+    {
+        emit({opcode, (target - (here() + 2)) & 0xFF});
+    }
+    void jump(int opcode, unsigned short target) // JMP or JSR
+    {
+        emit({opcode, target & 0xFF, target >> 8});
+    }
+    void vectors(unsigned short nmi, unsigned short reset, unsigned short irq)
+    {
+        unsigned short at[3] = {nmi, reset, irq};
+        for(int i = 0; i < 3; i++)
+        {
+            prg[SYNTH_PRG_SIZE - 6 + i*2] = at[i] & 0xFF;
+            prg[SYNTH_PRG_SIZE - 5 + i*2] = at[i] >> 8;
+        }
+    }
+private:
+    size_t size = 0;
+};
+
+static std::vector<unsigned char> make_nrom(const std::vector<unsigned char> &prg)
+{
+    static const unsigned char header[16] = {'N', 'E', 'S', 0x1A, 1, 1, 0x01}; // 16kb PRG, 8kb CHR, vertical
+    std::vector<unsigned char> image(sizeof(header) + SYNTH_PRG_SIZE + SYNTH_CHR_SIZE);
+    std::copy(header, header + sizeof(header), image.begin());
+    std::copy(prg.begin(), prg.end(), image.begin() + sizeof(header));
+    unsigned int seed = 12345; // CHR is noise so every tile has pixels to draw
+    for(int i = 0; i < SYNTH_CHR_SIZE; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        image[sizeof(header) + SYNTH_PRG_SIZE + i] = seed >> 16;
+    }
+    return image;
+}
+
+// SEI, CLD, stack at $1FF, PPU off, then wait out the PPU's warm-up frames
+static void boot(Assembler &a)
+{
+    a.emit({0x78, 0xD8, 0xA2, 0xFF, 0x9A}); // SEI CLD LDX #$FF TXS
+    a.emit({0xA9, 0x00, 0x8D, 0x00, 0x20, 0x8D, 0x01, 0x20}); // LDA #0 STA $2000 STA $2001
+    for(int i = 0; i < 2; i++)
+    {
+        unsigned short wait = a.here();
+        a.emit({0x2C, 0x02, 0x20}); // BIT $2002
+        a.branch(0x10, wait); // BPL
+    }
+}
+
+static std::vector<unsigned char> cpu_rom()
+{
+    Assembler a;
+    boot(a);
+    unsigned short loop = a.here();
+    a.emit({0xA2, 0x00}); // LDX #0
+    unsigned short inner = a.here();
+    a.emit({0xBD, 0x00, 0x03}); // LDA $0300,X
+    a.emit({0x69, 0x13}); // ADC #$13
+    a.emit({0x9D, 0x00, 0x03}); // STA $0300,X
+    a.emit({0x45, 0x00, 0x85, 0x00}); // EOR $00 STA $00
+    unsigned short call = a.here();
+    a.jump(0x20, 0); // JSR sub, patched below
+    a.emit({0xE8}); // INX
+    a.branch(0xD0, inner); // BNE
+    a.emit({0xE6, 0x01}); // INC $01
+    a.jump(0x4C, loop);
+    unsigned short sub = a.here();
+    a.emit({0xA5, 0x01, 0x0A, 0x26, 0x02, 0x60}); // LDA $01 ASL A ROL $02 RTS
+    a.prg[call - 0x8000 + 1] = sub & 0xFF;
+    a.prg[call - 0x8000 + 2] = sub >> 8;
+    unsigned short rti = a.here();
+    a.emit({0x40});
+    a.vectors(rti, 0x8000, rti);
+    return make_nrom(a.prg);
+}
+
+static std::vector<unsigned char> ppu_regs_rom()
+{
+    Assembler a;
+    boot(a);
+    unsigned short loop = a.here();
+    a.emit({0xAD, 0x02, 0x20}); // LDA $2002
+    a.emit({0xA9, 0x20, 0x8D, 0x06, 0x20, 0xA9, 0x00, 0x8D, 0x06, 0x20}); // PPUADDR $2000
+    a.emit({0xA2, 0x40}); // LDX #64
+    unsigned short write = a.here();
+    a.emit({0x8E, 0x07, 0x20, 0xCA}); // STX $2007 DEX
+    a.branch(0xD0, write);
+    a.emit({0xA9, 0x20, 0x8D, 0x06, 0x20, 0xA9, 0x00, 0x8D, 0x06, 0x20});
+    a.emit({0xA2, 0x10}); // LDX #16
+    unsigned short read = a.here();
+    a.emit({0xAD, 0x07, 0x20, 0xCA}); // LDA $2007 DEX
+    a.branch(0xD0, read);
+    a.emit({0xA9, 0x00, 0x8D, 0x05, 0x20, 0x8D, 0x05, 0x20}); // PPUSCROLL 0,0
+    a.emit({0x8D, 0x03, 0x20, 0x8E, 0x04, 0x20}); // STA $2003 STX $2004
+    a.jump(0x4C, loop);
+    unsigned short rti = a.here();
+    a.emit({0x40});
+    a.vectors(rti, 0x8000, rti);
+    return make_nrom(a.prg);
+}
+
+static std::vector<unsigned char> sprites_rom()
+{
+    Assembler a;
+    boot(a);
+    // Palette, then a nametable of incrementing tiles
+    a.emit({0xA9, 0x3F, 0x8D, 0x06, 0x20, 0xA9, 0x00, 0x8D, 0x06, 0x20, 0xA2, 0x00});
+    unsigned short palette = a.here();
+    a.emit({0x8E, 0x07, 0x20, 0xE8, 0xE0, 0x20}); // STX $2007 INX CPX #32
+    a.branch(0xD0, palette);
+    a.emit({0xA9, 0x20, 0x8D, 0x06, 0x20, 0xA9, 0x00, 0x8D, 0x06, 0x20, 0xA0, 0x04, 0xA2, 0x00});
+    unsigned short fill = a.here();
+    a.emit({0x8E, 0x07, 0x20, 0xE8}); // STX $2007 INX
+    a.branch(0xD0, fill);
+    a.emit({0x88}); // DEY
+    a.branch(0xD0, fill);
+    // Copy the sprite table to the OAM page at $0200
+    unsigned short table_operand = a.here() + 3;
+    a.emit({0xA2, 0x00, 0xBD, 0x00, 0x00, 0x9D, 0x00, 0x02, 0xE8}); // LDX #0 LDA table,X STA $0200,X INX
+    a.branch(0xD0, table_operand - 1);
+    a.emit({0xA9, 0x80, 0x8D, 0x00, 0x20, 0xA9, 0x1E, 0x8D, 0x01, 0x20}); // NMI on, show everything
+    unsigned short idle = a.here();
+    a.emit({0xE6, 0x10}); // INC $10
+    a.jump(0x4C, idle);
+    // NMI: DMA the sprites, slide them all right, scroll the background
+    unsigned short nmi = a.here();
+    a.emit({0x48, 0x8A, 0x48, 0x98, 0x48}); // Save A, X, Y
+    a.emit({0xA9, 0x00, 0x8D, 0x03, 0x20, 0xA9, 0x02, 0x8D, 0x14, 0x40}); // OAMDMA from $0200
+    a.emit({0xA2, 0x03, 0xA0, 0x40}); // LDX #3 LDY #64
+    unsigned short move = a.here();
+    a.emit({0xFE, 0x00, 0x02, 0xE8, 0xE8, 0xE8, 0xE8, 0x88}); // INC $0200,X INX x4 DEY
+    a.branch(0xD0, move);
+    a.emit({0xAD, 0x02, 0x20, 0xE6, 0x11, 0xA5, 0x11, 0x8D, 0x05, 0x20, 0x8D, 0x05, 0x20}); // Scroll by $11
+    a.emit({0x68, 0xA8, 0x68, 0xAA, 0x68, 0x40}); // Restore, RTI
+    unsigned short table = a.here();
+    for(int sprite = 0; sprite < 64; sprite++) // Eight rows of eight sprites
+        a.emit({32 + (sprite / 8) * 24, sprite, sprite & 0x3, (sprite % 8) * 30});
+    a.prg[table_operand - 0x8000] = table & 0xFF;
+    a.prg[table_operand - 0x8000 + 1] = table >> 8;
+    a.vectors(nmi, 0x8000, nmi);
+    return make_nrom(a.prg);
+}
+
+std::vector<std::string> synthetic_rom_names()
+{
+    return {"cpu", "ppu-regs", "sprites"};
+}
+
+std::vector<unsigned char> synthetic_rom(const std::string &name)
+{
+    if(name == "cpu")
+        return cpu_rom();
+    if(name == "ppu-regs")
+        return ppu_regs_rom();
+    if(name == "sprites")
+        return sprites_rom();
+    return std::vector<unsigned char>();
+}
@@ -0,0 +1,15 @@
+#ifndef SYNTHROM_H
+#define SYNTHROM_H
+
+#include<string>
+#include<vector>
+
+// Small NROM images assembled in code, so benchmarks and checks have
+// deterministic workloads without shipping ROM files:
+//
+//   cpu       rendering off, a loop of loads, stores, arithmetic and JSR/RTS
+//   ppu-regs  rendering off, constant $2002/$2005/$2006/$2007 and OAM traffic
+//   sprites   rendering on, 64 sprites eight to a line, moved and DMAed every NMI
+std::vector<std::string> synthetic_rom_names();
+std::vector<unsigned char> synthetic_rom(const std::string &name); // Empty for an unknown name
+#endif
@@ -0,0 +1,315 @@
+#include<iostream>
+#include<fstream>
+#include<string>
+#include<vector>
+#include<memory>
+#include<chrono>
+#include<algorithm>
+#include<cstdio>
+#include<cstring>
+#include<dirent.h>
+#include<sys/stat.h>
+
+#include "console.h"
+#include "nesfile.h"
+#include "romdb.h"
+#include "workpool.h"
+
+// Runs test ROMs headless, in parallel, until each posts a result through
+// the status protocol most accuracy test ROMs (blargg's and others) share:
+//
+//   $6001-$6003  DE B0 61 once the protocol is active
+//   $6000        $80 while running, $81 to ask for the reset button,
+//                otherwise the final result code (0 means passed)
+//   $6004-       NUL terminated result text
+//
+// Each ROM stops as soon as its result is posted. Results go to the console
+// and optionally to JUnit XML and JSON reports.
+
+#define STATUS_RUNNING 0x80
+#define STATUS_NEEDS_RESET 0x81
+#define RESET_DELAY_FRAMES 6 // The protocol asks for at least 100ms before pressing reset
+#define STATUS_TEXT_MAX 1024
+
+struct TestResult
+{
+    std::string path;
+    std::string outcome; // passed, failed, timeout or error
+    int status; // Final $6000 value, -1 when none was posted
+    std::string text;
+    int frames;
+    int resets;
+    double seconds;
+};
+
+static void find_roms(const std::string &path, std::vector<std::string> &roms)
+{
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+    {
+        std::cout << "CAN'T OPEN " << path << std::endl;
+        return;
+    }
+    if(!S_ISDIR(st.st_mode))
+    {
+        roms.push_back(path);
+        return;
+    }
+    DIR *handle = opendir(path.c_str());
+    if(!handle)
+    {
+        std::cout << "CAN'T OPEN DIRECTORY " << path << std::endl;
+        return;
+    }
+    while(dirent *entry = readdir(handle))
+    {
+        std::string name = entry->d_name;
+        if(name == "." || name == "..")
+            continue;
+        std::string child = path + "/" + name;
+        if(lstat(child.c_str(), &st) != 0) // Symlinks are skipped so loops can't recurse forever
+            continue;
+        if(S_ISDIR(st.st_mode))
+            find_roms(child, roms);
+        else if(S_ISREG(st.st_mode) && name.size() > 4 && name.compare(name.size() - 4, 4, ".nes") == 0)
+            roms.push_back(child);
+    }
+    closedir(handle);
+}
+
+static bool protocol_active(const unsigned char *prg_ram)
+{
+    return prg_ram && prg_ram[1] == 0xDE && prg_ram[2] == 0xB0 && prg_ram[3] == 0x61;
+}
+
+static TestResult run_test(const std::string &path, std::shared_ptr<const NESFile> rom, int timeout_frames)
+{
+    TestResult result = {path, "error", -1, "", 0, 0, 0};
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Console> console(new Console);
+    if(!console->load_cartridge(rom))
+    {
+        result.text = rom->valid ? "unsupported mapper " + std::to_string(rom->mapper) : rom->error;
+        return result;
+    }
+    const unsigned char *prg_ram = console->mapper->prg_ram();
+    if(!prg_ram)
+    {
+        result.text = "no PRG RAM at $6000";
+        return result;
+    }
+    int reset_at = -1;
+    result.outcome = "timeout";
+    while(result.frames < timeout_frames)
+    {
+        console->run_frame(false);
+        result.frames++;
+        if(!protocol_active(prg_ram))
+            continue;
+        unsigned char status = prg_ram[0];
+        if(status == STATUS_NEEDS_RESET)
+        {
+            if(reset_at < 0)
+                reset_at = result.frames + RESET_DELAY_FRAMES;
+            else if(result.frames >= reset_at)
+            {
+                console->reset();
+                result.resets++;
+                reset_at = -1;
+            }
+        }
+        else if(status < STATUS_RUNNING)
+        {
+            result.status = status;
+            result.outcome = status == 0 ? "passed" : "failed";
+            break;
+        }
+    }
+    if(protocol_active(prg_ram))
+    {
+        const char *text = (const char *)prg_ram + 4;
+        result.text.assign(text, strnlen(text, std::min(STATUS_TEXT_MAX, MAPPER_PRG_RAM_SIZE - 4)));
+        if(result.outcome == "timeout")
+            result.status = prg_ram[0];
+    }
+    else if(result.outcome == "timeout")
+        result.text = "no status posted at $6000";
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+static std::string xml_escape(const std::string &text)
+{
+    std::string out;
+    for(char c : text)
+    {
+        if(c == '<')
+            out += "&lt;";
+        else if(c == '>')
+            out += "&gt;";
+        else if(c == '&')
+            out += "&amp;";
+        else if(c == '"')
+            out += "&quot;";
+        else if((unsigned char)c < 0x20 && c != '\n' && c != '\t')
+            out += ' ';
+        else
+            out += c;
+    }
+    return out;
+}
+
+static std::string json_escape(const std::string &text)
+{
+    std::string out;
+    char code[8];
+    for(char c : text)
+    {
+        if(c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if(c == '\n')
+            out += "\\n";
+        else if((unsigned char)c < 0x20)
+        {
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        }
+        else
+            out += c;
+    }
+    return out;
+}
+
+static void write_junit(std::ostream &out, const std::vector<TestResult> &results, double seconds)
+{
+    int failures = 0, errors = 0;
+    for(const TestResult &result : results)
+    {
+        failures += result.outcome == "failed" || result.outcome == "timeout";
+        errors += result.outcome == "error";
+    }
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    out << "<testsuite name=\"nes test roms\" tests=\"" << results.size() << "\" failures=\"" << failures
+        << "\" errors=\"" << errors << "\" time=\"" << seconds << "\">\n";
+    for(const TestResult &result : results)
+    {
+        out << "  <testcase classname=\"roms\" name=\"" << xml_escape(result.path) << "\" time=\"" << result.seconds << "\">";
+        if(result.outcome == "failed" || result.outcome == "timeout")
+            out << "\n    <failure message=\"" << result.outcome << " with status " << result.status << " after " << result.frames
+                << " frames\">" << xml_escape(result.text) << "</failure>\n  ";
+        else if(result.outcome == "error")
+            out << "\n    <error message=\"" << xml_escape(result.text) << "\"/>\n  ";
+        else if(!result.text.empty())
+            out << "\n    <system-out>" << xml_escape(result.text) << "</system-out>\n  ";
+        out << "</testcase>\n";
+    }
+    out << "</testsuite>\n";
+}
+
+static void write_json(std::ostream &out, const std::vector<TestResult> &results, double seconds)
+{
+    out << "{\"seconds\": " << seconds << ", \"tests\": [\n";
+    for(size_t i = 0; i < results.size(); i++)
+    {
+        const TestResult &result = results[i];
+        out << "  {\"rom\": \"" << json_escape(result.path) << "\", \"outcome\": \"" << result.outcome << "\", \"status\": " << result.status
+            << ", \"frames\": " << result.frames << ", \"resets\": " << result.resets << ", \"seconds\": " << result.seconds
+            << ", \"text\": \"" << json_escape(result.text) << "\"}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]}\n";
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> paths;
+    std::string junit_path;
+    std::string json_path;
+    std::string db_path;
+    int threads = 0;
+    int timeout_frames = 60 * 60; // A minute of emulated time
+    bool verbose = false;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--junit" && i + 1 < argc)
+            junit_path = argv[++i];
+        else if(arg == "--json" && i + 1 < argc)
+            json_path = argv[++i];
+        else if(arg == "--db" && i + 1 < argc)
+            db_path = argv[++i];
+        else if(arg == "--threads" && i + 1 < argc)
+            threads = std::stoi(argv[++i]);
+        else if(arg == "--timeout-frames" && i + 1 < argc)
+            timeout_frames = std::max(1, std::stoi(argv[++i]));
+        else if(arg == "-v")
+            verbose = true;
+        else
+            paths.push_back(arg);
+    }
+    if(paths.empty())
+    {
+        std::cout << "Usage: " << argv[0] << " [--threads N] [--timeout-frames N] [--junit report.xml] [--json report.json] [--db nes.db] [-v] dir-or-rom..." << std::endl;
+        return 1;
+    }
+    std::vector<std::string> roms;
+    for(const std::string &path : paths)
+        find_roms(path, roms);
+    std::sort(roms.begin(), roms.end());
+    RomDB db;
+    if(!db_path.empty() && !db.load(db_path))
+        std::cout << "CAN'T LOAD DB " << db_path << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<TestResult> results(roms.size());
+    {
+        WorkPool pool(threads);
+        threads = pool.size();
+        for(size_t i = 0; i < roms.size(); i++)
+        {
+            pool.submit([&, i](int)
+            {
+                results[i] = run_test(roms[i], NESFile::shared(roms[i], &db), timeout_frames);
+            });
+        }
+        pool.wait();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    int passed = 0;
+    for(const TestResult &result : results)
+    {
+        std::string outcome = result.outcome;
+        std::transform(outcome.begin(), outcome.end(), outcome.begin(), ::toupper);
+        std::cout << outcome << " " << result.path << " (" << result.frames << " FRAMES, " << result.seconds << "s";
+        if(result.status >= 0 && result.outcome != "passed")
+            std::cout << ", STATUS " << result.status;
+        std::cout << ")" << std::endl;
+        if(!result.text.empty() && (verbose || result.outcome != "passed"))
+        {
+            std::string text = result.text.substr(0, result.text.find_last_not_of(" \n") + 1);
+            for(size_t at = text.find('\n'); at != std::string::npos; at = text.find('\n', at + 3))
+                text.replace(at, 1, "\n  ");
+            std::cout << "  " << text << std::endl;
+        }
+        passed += result.outcome == "passed";
+    }
+    if(!junit_path.empty())
+    {
+        std::ofstream out(junit_path);
+        write_junit(out, results, seconds);
+        if(!out)
+            std::cout << "CAN'T WRITE " << junit_path << std::endl;
+    }
+    if(!json_path.empty())
+    {
+        std::ofstream out(json_path);
+        write_json(out, results, seconds);
+        if(!out)
+            std::cout << "CAN'T WRITE " << json_path << std::endl;
+    }
+    std::cout << passed << "/" << results.size() << " PASSED IN " << seconds << "s ON " << threads << " THREADS" << std::endl;
+    return passed == (int)results.size() ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+#include<vector>
+#include<memory>
+#include<mutex>
+#include<thread>
+#include<condition_variable>
+#include<chrono>
+#include<fstream>
+#include<cstdio>
+
+#include "trace.h"
+
+const char *FrameTracer::batch_names[6] = {"pre-render", "lines 0-59", "lines 60-119", "lines 120-179", "lines 180-239", "vblank"};
+
+std::atomic<bool> trace_on(false);
+
+struct TraceEvent
+{
+    const char *name;
+    unsigned long long ns;
+    char phase;
+    unsigned char track;
+};
+
+// Single producer (the owning thread), single consumer (the writer)
+struct TraceRing
+{
+    std::vector<TraceEvent> events;
+    std::atomic<size_t> head; // Next slot the producer fills
+    std::atomic<size_t> tail; // Next slot the writer drains
+    std::atomic<unsigned long long> dropped;
+    std::string name;
+    int id;
+    bool named; // Thread name written to the current file
+};
+
+static std::mutex rings_lock;
+static std::vector<std::unique_ptr<TraceRing>> rings; // Never freed, threads may outlive a trace
+static thread_local TraceRing *local_ring = nullptr;
+
+static std::mutex writer_lock;
+static std::condition_variable writer_wake;
+static std::thread writer;
+static bool writer_stopping;
+static std::ofstream trace_file;
+static bool first_event;
+static std::chrono::steady_clock::time_point trace_epoch;
+
+static TraceRing *thread_ring()
+{
+    if(!local_ring)
+    {
+        std::unique_ptr<TraceRing> ring(new TraceRing);
+        ring->events.resize(TRACE_RING_EVENTS);
+        ring->head = 0;
+        ring->tail = 0;
+        ring->dropped = 0;
+        ring->named = false;
+        std::lock_guard<std::mutex> hold(rings_lock);
+        ring->id = rings.size() + 1;
+        ring->name = "thread " + std::to_string(ring->id);
+        local_ring = ring.get();
+        rings.push_back(std::move(ring));
+    }
+    return local_ring;
+}
+
+static void record(const char *name, char phase, int track)
+{
+    TraceRing *ring = thread_ring();
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    if(head - ring->tail.load(std::memory_order_acquire) >= TRACE_RING_EVENTS)
+    {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    TraceEvent &event = ring->events[head % TRACE_RING_EVENTS];
+    event.name = name;
+    event.ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+    event.phase = phase;
+    event.track = track;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void trace_begin(const char *name, int track)
+{
+    if(tracing())
+        record(name, 'B', track);
+}
+
+void trace_end(const char *name, int track)
+{
+    if(tracing())
+        record(name, 'E', track);
+}
+
+void trace_instant(const char *name, int track)
+{
+    if(tracing())
+        record(name, 'i', track);
+}
+
+void trace_thread_name(const char *name)
+{
+    TraceRing *ring = thread_ring();
+    std::lock_guard<std::mutex> hold(rings_lock);
+    if(ring->name != name)
+    {
+        ring->name = name;
+        ring->named = false;
+    }
+}
+
+// Rows are numbered so each thread's CPU row sits right under its main row
+static int row(const TraceRing &ring, int track)
+{
+    return ring.id * 2 + track;
+}
+
+static void write_event(const char *text)
+{
+    trace_file << (first_event ? "\n" : ",\n") << text;
+    first_event = false;
+}
+
+static void drain()
+{
+    std::vector<TraceRing *> current;
+    {
+        std::lock_guard<std::mutex> hold(rings_lock);
+        for(std::unique_ptr<TraceRing> &ring : rings)
+        {
+            current.push_back(ring.get());
+            if(!ring->named)
+            {
+                char line[160];
+                std::snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", row(*ring, TRACK_MAIN), ring->name.c_str());
+                write_event(line);
+                std::snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s cpu\"}}", row(*ring, TRACK_CPU), ring->name.c_str());
+                write_event(line);
+                ring->named = true;
+            }
+        }
+    }
+    char line[160];
+    for(TraceRing *ring : current)
+    {
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+        size_t head = ring->head.load(std::memory_order_acquire);
+        for(; tail != head; tail++)
+        {
+            const TraceEvent &event = ring->events[tail % TRACE_RING_EVENTS];
+            std::snprintf(line, sizeof(line), "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%d%s}",
+                event.name, event.phase, event.ns / 1000, event.ns % 1000, row(*ring, event.track), event.phase == 'i' ? ",\"s\":\"t\"" : "");
+            write_event(line);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+    }
+    trace_file.flush();
+}
+
+static void write_loop()
+{
+    std::unique_lock<std::mutex> hold(writer_lock);
+    while(!writer_stopping)
+    {
+        writer_wake.wait_for(hold, std::chrono::milliseconds(TRACE_FLUSH_MS));
+        drain();
+    }
+}
+
+bool trace_start(const std::string &path)
+{
+    if(tracing())
+        return false;
+    trace_file.open(path, std::ios::out | std::ios::trunc);
+    if(!trace_file)
+        return false;
+    {
+        std::lock_guard<std::mutex> hold(rings_lock);
+        for(std::unique_ptr<TraceRing> &ring : rings)
+        {
+            ring->tail.store(ring->head.load());
+            ring->dropped = 0;
+            ring->named = false;
+        }
+    }
+    trace_file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    first_event = true;
+    trace_epoch = std::chrono::steady_clock::now();
+    writer_stopping = false;
+    writer = std::thread(write_loop);
+    trace_on = true;
+    return true;
+}
+
+void trace_stop()
+{
+    if(!tracing())
+        return;
+    trace_on = false;
+    {
+        std::lock_guard<std::mutex> hold(writer_lock);
+        writer_stopping = true;
+    }
+    writer_wake.notify_one();
+    writer.join();
+    unsigned long long dropped = 0;
+    {
+        std::lock_guard<std::mutex> hold(rings_lock);
+        for(std::unique_ptr<TraceRing> &ring : rings)
+            dropped += ring->dropped;
+    }
+    trace_file << "\n]}\n";
+    trace_file.close();
+    if(dropped)
+        std::cout << "TRACE DROPPED " << dropped << " EVENTS" << std::endl;
+}
@@ -0,0 +1,132 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include<atomic>
+#include<string>
+
+#include "cpu.h"
+#include "ppu.h"
+
+// Chrome trace-event output, viewable in Perfetto or about:tracing. Each
+// thread appends to its own preallocated ring without locking and a
+// background thread drains the rings to the file, so recording an event is
+// a clock read and a few stores. Event names must be string literals (or
+// otherwise outlive the trace) since only the pointer is recorded.
+
+#define TRACE_RING_EVENTS 0x10000 // Per thread; events past this between drains are dropped
+#define TRACE_FLUSH_MS 50
+
+// Each thread gets two timeline rows: host/frame work and CPU events that
+// don't nest inside the frame's scanline spans
+#define TRACK_MAIN 0
+#define TRACK_CPU 1
+
+extern std::atomic<bool> trace_on;
+
+inline bool tracing()
+{
+    return trace_on.load(std::memory_order_relaxed);
+}
+
+bool trace_start(const std::string &path); // Truncates path
+void trace_stop(); // Flushes everything recorded and closes the file
+void trace_thread_name(const char *name); // Labels the calling thread's rows
+void trace_begin(const char *name, int track = TRACK_MAIN);
+void trace_end(const char *name, int track = TRACK_MAIN);
+void trace_instant(const char *name, int track = TRACK_MAIN);
+
+// Spans its own lifetime, if tracing was on when it was created
+class TraceSpan
+{
+public:
+    TraceSpan(const char *name, int track = TRACK_MAIN) : name(name), track(track), active(tracing())
+    {
+        if(active)
+            trace_begin(name, track);
+    }
+    ~TraceSpan()
+    {
+        if(active)
+            trace_end(name, track);
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+private:
+    const char *name;
+    int track;
+    bool active;
+};
+
+// Console::step_frame hooks that record the frame, scanline batches, NMI
+// handlers (from entry to their RTI) and OAM DMA stalls. NMI and DMA spans
+// still open when the frame ends are cut there so every span stays balanced.
+class FrameTracer
+{
+public:
+    void frame_begin()
+    {
+        trace_begin("frame");
+        batch = -1;
+    }
+    void frame_end()
+    {
+        if(batch >= 0)
+            trace_end(batch_names[batch]);
+        if(in_dma)
+            trace_end("oam dma", TRACK_CPU);
+        if(in_nmi)
+            trace_end("nmi", TRACK_CPU);
+        in_dma = in_nmi = false;
+        trace_end("frame");
+    }
+    void ppu_begin(const PPU &ppu)
+    {
+        int line_batch = ppu.scanline < 0 ? 0 : ppu.scanline < 240 ? 1 + ppu.scanline / 60 : 5;
+        if(line_batch != batch)
+        {
+            if(batch >= 0)
+                trace_end(batch_names[batch]);
+            batch = line_batch;
+            trace_begin(batch_names[batch]);
+        }
+    }
+    void cpu_begin(const CPU &cpu)
+    {
+        nmi_pending = cpu.NMI;
+        dma_pending = cpu.oam_write_pending;
+        // clocks_remain reaches 0 this cycle, so the instruction at PC runs
+        rti = in_nmi && !dma_pending && cpu.clocks_remain == 1 && cpu.peek_memory(cpu.PC) == 0x40;
+    }
+    void cpu_end(const CPU &cpu)
+    {
+        if(rti)
+        {
+            trace_end("nmi", TRACK_CPU);
+            in_nmi = false;
+        }
+        if(nmi_pending && !cpu.NMI && !in_nmi)
+        {
+            trace_begin("nmi", TRACK_CPU);
+            in_nmi = true;
+        }
+        if(!dma_pending && cpu.oam_write_pending)
+        {
+            trace_begin("oam dma", TRACK_CPU);
+            in_dma = true;
+        }
+        else if(dma_pending && !cpu.oam_write_pending && in_dma)
+        {
+            trace_end("oam dma", TRACK_CPU);
+            in_dma = false;
+        }
+    }
+private:
+    static const char *batch_names[6];
+    int batch = -1;
+    bool in_nmi = false;
+    bool in_dma = false;
+    bool nmi_pending = false;
+    bool dma_pending = false;
+    bool rti = false;
+};
+#endif
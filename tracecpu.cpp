@@ -0,0 +1,113 @@
+#include<iostream>
+#include<string>
+#include<memory>
+#include<chrono>
+
+#include "console.h"
+#include "nesfile.h"
+#include "romdb.h"
+#include "cpulog.h"
+
+// Traces every instruction a ROM executes in the nestest.log format, and/or
+// checks the trace against a reference log from another emulator as it
+// runs, stopping at the first instruction that differs.
+//
+//   tracecpu --nestest --compare nestest.log nestest.nes
+//
+// --nestest starts at $C000 with the register and cycle values the
+// reference nestest.log was made with, which runs the ROM's automated mode
+// without a PPU.
+
+int main(int argc, char *argv[])
+{
+    const char *rom_path = nullptr;
+    std::string out_path;
+    std::string reference_path;
+    std::string db_path;
+    bool timing = false;
+    bool nestest = false;
+    long long max_instructions = 0;
+    int max_frames = 60 * 60;
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if(arg == "--out" && i + 1 < argc)
+            out_path = argv[++i];
+        else if(arg == "--compare" && i + 1 < argc)
+            reference_path = argv[++i];
+        else if(arg == "--db" && i + 1 < argc)
+            db_path = argv[++i];
+        else if(arg == "--instructions" && i + 1 < argc)
+            max_instructions = std::stoll(argv[++i]);
+        else if(arg == "--frames" && i + 1 < argc)
+            max_frames = std::stoi(argv[++i]);
+        else if(arg == "--timing")
+            timing = true;
+        else if(arg == "--nestest")
+            nestest = true;
+        else
+            rom_path = argv[i];
+    }
+    if(!rom_path || (out_path.empty() && reference_path.empty()))
+    {
+        std::cout << "Usage: " << argv[0] << " [--out trace.log|-] [--compare reference.log] [--timing] [--nestest] [--instructions N] [--frames N] [--db nes.db] rom.nes" << std::endl;
+        return 1;
+    }
+    RomDB db;
+    if(!db_path.empty() && !db.load(db_path))
+        std::cout << "CAN'T LOAD DB " << db_path << std::endl;
+    std::unique_ptr<Console> console(new Console);
+    std::shared_ptr<const NESFile> rom = NESFile::shared(rom_path, &db);
+    if(!console->load_cartridge(rom))
+    {
+        std::cout << "CAN'T LOAD " << rom_path << std::endl;
+        return 1;
+    }
+    if(nestest)
+    {
+        CPU &cpu = console->cpu;
+        cpu.PC = 0xC000;
+        cpu.S = 0x1FD;
+        cpu.flags_carry = 0;
+        cpu.flags_zero = 0;
+        cpu.cycle = 7; // The reset sequence
+        for(int dot = 0; dot < 21; dot++)
+            console->ppu.do_cycle();
+    }
+
+    CPULog log;
+    log.limit = max_instructions;
+    if(!out_path.empty() && !log.open(out_path))
+    {
+        std::cout << "CAN'T WRITE " << out_path << std::endl;
+        return 1;
+    }
+    if(!reference_path.empty() && !log.compare(reference_path, timing))
+    {
+        std::cout << "CAN'T OPEN " << reference_path << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::steady_clock::now();
+    int frames = 0;
+    while(frames < max_frames && !log.done())
+    {
+        console->step_frame(log, false);
+        frames++;
+    }
+    log.close();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::ostream &report = out_path == "-" ? std::cerr : std::cout;
+    report << "TRACED " << log.lines << " INSTRUCTIONS IN " << frames << " FRAMES, " << seconds << "s" << std::endl;
+    if(log.mismatch)
+    {
+        report << "MISMATCH AT LINE " << log.mismatch_line << std::endl;
+        if(!log.previous.empty())
+            report << "  previous: " << log.previous << std::endl;
+        report << "  expected: " << log.expected << std::endl;
+        report << "  got:      " << log.got << std::endl;
+        return 1;
+    }
+    if(!reference_path.empty())
+        report << "MATCHED " << log.lines << " LINES" << (log.reference_ended ? " (END OF REFERENCE)" : "") << std::endl;
+    return 0;
+}
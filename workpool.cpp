@@ -0,0 +1,115 @@
+#include<algorithm>
+
+#include "workpool.h"
+
+static thread_local WorkPool *current_pool = nullptr;
+static thread_local int current_worker = -1;
+
+WorkPool::WorkPool(int threads)
+{
+    if(threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    queued = 0;
+    pending = 0;
+    next_queue = 0;
+    stopping = false;
+    for(int i = 0; i < threads; i++)
+        queues.emplace_back(new Queue);
+    for(int i = 0; i < threads; i++)
+        workers.emplace_back(&WorkPool::run, this, i);
+}
+
+WorkPool::~WorkPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(std::thread &worker : workers)
+        worker.join();
+}
+
+int WorkPool::size()
+{
+    return queues.size();
+}
+
+void WorkPool::submit(Task task)
+{
+    size_t target;
+    if(current_pool == this)
+        target = current_worker;
+    else
+    {
+        std::lock_guard<std::mutex> guard(state_lock);
+        target = next_queue++ % queues.size();
+    }
+    {
+        std::lock_guard<std::mutex> guard(state_lock); // Counted first so a fast worker can't finish it before it's pending
+        queued++;
+        pending++;
+    }
+    {
+        std::lock_guard<std::mutex> guard(queues[target]->lock);
+        queues[target]->tasks.push_back(std::move(task));
+    }
+    wake.notify_one();
+}
+
+void WorkPool::wait()
+{
+    std::unique_lock<std::mutex> guard(state_lock);
+    finished.wait(guard, [this]() { return pending == 0; });
+}
+
+// Own deque from the back, then everyone else's from the front
+bool WorkPool::take(int worker, Task &task)
+{
+    for(size_t i = 0; i < queues.size(); i++)
+    {
+        Queue &queue = *queues[(worker + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if(queue.tasks.empty())
+            continue;
+        if(i == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    }
+    return false;
+}
+
+void WorkPool::run(int worker)
+{
+    current_pool = this;
+    current_worker = worker;
+    for(;;)
+    {
+        Task task;
+        if(take(worker, task))
+        {
+            {
+                std::lock_guard<std::mutex> guard(state_lock);
+                queued--;
+            }
+            task(worker);
+            std::lock_guard<std::mutex> guard(state_lock);
+            if(--pending == 0)
+                finished.notify_all();
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(state_lock);
+        if(stopping)
+            return;
+        wake.wait(guard, [this]() { return stopping || queued > 0; });
+    }
+}
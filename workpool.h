@@ -0,0 +1,45 @@
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include<functional>
+#include<vector>
+#include<deque>
+#include<thread>
+#include<mutex>
+#include<condition_variable>
+#include<memory>
+
+// A fixed set of worker threads, each with its own task deque. Workers take
+// their newest task first and, once their own deque is empty, steal the oldest
+// task from another worker's, so uneven jobs still keep every core busy.
+// Tasks submitted from inside a task go to the submitting worker's deque.
+class WorkPool
+{
+public:
+    typedef std::function<void(int worker)> Task; // worker is 0..size()-1, for per-worker scratch data
+    WorkPool(int threads = 0); // 0 uses every hardware thread
+    ~WorkPool();
+    WorkPool(const WorkPool &) = delete;
+    WorkPool &operator=(const WorkPool &) = delete;
+    void submit(Task task);
+    void wait(); // Until every submitted task has finished
+    int size();
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex state_lock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    size_t queued; // Submitted but not yet picked up
+    size_t pending; // Submitted but not yet finished
+    size_t next_queue;
+    bool stopping;
+    bool take(int worker, Task &task);
+    void run(int worker);
+};
+#endif